@@ -0,0 +1,369 @@
+#include <math.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "treesearchpar.h"
+#include "results.h"
+#include "workloads.h"
+
+/* Benchmark driver: runs registered workloads (workloads.h) with the
+ * parallel engine, checks every run against the expected tree (and its
+ * fingerprint, with -F 1), and prints the median, minimum and standard
+ * deviation of the time and the rate of the timed runs, one row per
+ * workload, as CSV or JSON on stdout. Exits non-zero if any run produced
+ * the wrong tree.
+ *
+ *   $ ./bench -w small,T1L -W 1 -R 10 -o json -p 16
+ *
+ * Flags other than the driver's own are passed on to the engine; the
+ * tree parameters come from the table.
+ *
+ * Strong scaling: with -S 1,2,4,... each workload is run by the
+ * sequential depth-first search (Ts) and then by the parallel engine at
+ * each worker count (Tp), in this process. Speedup and efficiency are
+ * given against 1-worker par (T1/Tp) and against dfs (Ts/Tp), and the
+ * overhead of the parallel engine is T1/Ts. One worker is always run.
+ *
+ * Regression tracking (results.h): -A store appends every timed run to
+ * the store, and -C store compares the rates of this invocation with a
+ * baseline from it, the latest set or the runs of revision -D, and
+ * exits with 2 if any is significantly lower at level -L (0.05).
+ */
+
+struct bench_config {
+  const char *workloads = NULL;
+  int warmup = 1;           // untimed runs first, checked all the same
+  int reps = 5;             // timed runs
+  bool json = false;
+  std::vector<int> sweep;   // worker counts, empty: no sweep
+  const char *appendFile = NULL;    // results store to add the runs to
+  const char *compareFile = NULL;   // results store to compare them with
+  const char *baseline = NULL;      // revision compared with, or latest set
+  double level = 0.05;              // significance of a regression
+};
+
+static bench_config benchConfig;
+
+struct bench_row {
+  const uts_workload *w;
+  bool seq;                 // run by dfsSearch
+  int workers;
+  bool valid;
+  int runs;
+  double timeMedian, timeMin, timeStddev;
+  double rateMedian, rateMin, rateStddev;
+  std::vector<double> times, rates;   // of the timed runs
+};
+
+void bench_helpMessage() {
+  printf("  Benchmark driver parameters:\n");
+  printf("   -w  list  workloads and suites, comma-separated (");
+  for (int i = 0; i < uts_numWorkloads; i++) printf("%s ", uts_workloads[i].name);
+  printf("\n             small large xl xxl wl all)\n");
+  printf("   -W  int   warm-up runs per workload (default 1)\n");
+  printf("   -R  int   timed runs per workload (default 5)\n");
+  printf("   -o  fmt   output format, csv or json\n");
+  printf("   -S  list  strong-scaling sweep over these worker counts, e.g. 1,2,4,8\n");
+  printf("   -A  file  append the timed runs to this results store\n");
+  printf("   -C  file  compare the runs with a baseline from this results store\n");
+  printf("   -D  rev   baseline revision (default: the latest set stored)\n");
+  printf("   -L  dble  significance level of a regression (default 0.05)\n\n");
+}
+
+// Worker counts of a sweep, in increasing order, always with 1.
+bool parseSweep(const char *list) {
+  std::vector<int> &v = benchConfig.sweep;
+  v.assign(1, 1);
+  for (const char *p = list; *p != '\0'; p++) {
+    char *end;
+    long n = strtol(p, &end, 10);
+    if (end == p || n < 1 || (*end != ',' && *end != '\0')) return false;
+    v.push_back((int) n);
+    p = end;
+    if (*p == '\0') break;
+  }
+  std::sort(v.begin(), v.end());
+  v.erase(std::unique(v.begin(), v.end()), v.end());
+  return true;
+}
+
+// Take the driver's own flags out of argv, leaving the engine's.
+int bench_parseParams(int argc, char *argv[]) {
+  int n = 1;
+  for (int i = 1; i < argc; i++) {
+    if (argv[i][0] == '-' && argv[i][1] == 'h') bench_helpMessage();
+    if (i + 1 < argc && strlen(argv[i]) == 2 && argv[i][0] == '-') {
+      char *v = argv[i+1];
+      switch (argv[i][1]) {
+        case 'w': benchConfig.workloads = v; i++; continue;
+        case 'W': benchConfig.warmup = max(0, atoi(v)); i++; continue;
+        case 'R': benchConfig.reps = max(1, atoi(v)); i++; continue;
+        case 'o':
+          if (strcmp(v, "csv") && strcmp(v, "json")) {
+            fprintf(stderr, "*** Unknown output format '%s'\n", v);
+            impl_abort(4);
+          }
+          benchConfig.json = !strcmp(v, "json");
+          i++;
+          continue;
+        case 'A': benchConfig.appendFile = v; i++; continue;
+        case 'C': benchConfig.compareFile = v; i++; continue;
+        case 'D': benchConfig.baseline = v; i++; continue;
+        case 'L':
+          benchConfig.level = atof(v);
+          if (benchConfig.level <= 0.0 || benchConfig.level >= 1.0) {
+            fprintf(stderr, "*** Bad significance level '%s'\n", v);
+            impl_abort(4);
+          }
+          i++;
+          continue;
+        case 'S':
+          if (!parseSweep(v)) {
+            fprintf(stderr, "*** Bad list of worker counts '%s'\n", v);
+            impl_abort(4);
+          }
+          i++;
+          continue;
+      }
+    }
+    argv[n++] = argv[i];
+  }
+  return n;
+}
+
+// median, minimum and sample standard deviation
+void summarize(std::vector<double> v, double &median, double &minimum,
+               double &stddev) {
+  std::sort(v.begin(), v.end());
+  size_t n = v.size();
+  median = (n % 2) ? v[n/2] : (v[n/2 - 1] + v[n/2]) / 2.0;
+  minimum = v[0];
+  double mean = 0.0, ss = 0.0;
+  for (double x : v) mean += x / n;
+  for (double x : v) ss += (x - mean) * (x - mean);
+  stddev = (n > 1) ? sqrt(ss / (n - 1)) : 0.0;
+}
+
+// Run w with the parallel engine, or with the sequential search if seq.
+bench_row runWorkload(const uts_workload &w, UTSConfig *base, bool seq) {
+  UTSConfig config;
+  Node root;
+  uts_workloadConfig(w, &config);
+  int verbose = config.verbose = base->verbose;
+  config.fingerprint = base->fingerprint;
+
+  bench_row row;
+  row.w = &w;
+  row.seq = seq;
+  row.workers = seq ? 1 : num_workers();
+  row.valid = true;
+  std::vector<double> &times = row.times, &rates = row.rates;
+  for (int i = 0; i < benchConfig.warmup + benchConfig.reps; i++) {
+    uts_initRoot(&config, &root);
+    double t1 = uts_wctime();
+    Result r = seq ? dfsSearch(&config, 0, &root)
+                   : treeSearch(&config, 0, &root);
+    double t2 = uts_wctime();
+
+    bool valid = uts_checkWorkload(w, r.size, r.maxdepth, r.leaves,
+                                   config.fingerprint != 0, r.fingerprint);
+    bool warmup = i < benchConfig.warmup;
+    if (!valid) {
+      fprintf(stderr, "*** %s: tree size = %llu, depth = %llu, leaves = %llu,"
+              " fingerprint = %016llx; expected %llu, %llu, %llu, %016llx\n",
+              w.name, r.size, r.maxdepth, r.leaves, r.fingerprint, w.size,
+              w.depth, w.leaves, w.fingerprint);
+      row.valid = false;
+    }
+    if (verbose > 0)
+      fprintf(stderr, "%-6s %-4s %3d %s %d: %.3f sec, %.0f nodes/sec%s\n",
+              w.name, seq ? "dfs" : "par", row.workers,
+              warmup ? "warm-up" : "run", warmup ? i + 1 : i + 1 - benchConfig.warmup,
+              t2 - t1, r.size / (t2 - t1), valid ? "" : " (WRONG TREE)");
+    if (!warmup) {
+      times.push_back(t2 - t1);
+      rates.push_back(r.size / (t2 - t1));
+    }
+  }
+  row.runs = (int) times.size();
+  summarize(times, row.timeMedian, row.timeMin, row.timeStddev);
+  summarize(rates, row.rateMedian, row.rateMin, row.rateStddev);
+  return row;
+}
+
+void printRows(std::vector<bench_row> &rows) {
+  if (!benchConfig.json)
+    printf("workload,engine,scheduler,workers,nodes,runs,valid,time_median,"
+           "time_min,time_stddev,rate_median,rate_min,rate_stddev\n");
+  else
+    printf("[\n");
+  for (size_t i = 0; i < rows.size(); i++) {
+    bench_row &b = rows[i];
+    if (!benchConfig.json) {
+      printf("%s,%s,%s,%d,%llu,%d,%d,%.6f,%.6f,%.6f,%.0f,%.0f,%.0f\n",
+             b.w->name, impl_getName(), scheduler_name().c_str(),
+             b.workers, b.w->size, b.runs, b.valid, b.timeMedian,
+             b.timeMin, b.timeStddev, b.rateMedian, b.rateMin, b.rateStddev);
+      continue;
+    }
+    printf("  {\"workload\": \"%s\", \"engine\": \"%s\", \"scheduler\": \"%s\","
+           " \"workers\": %d, \"nodes\": %llu, \"runs\": %d, \"valid\": %s,\n"
+           "   \"time_median\": %.6f, \"time_min\": %.6f, \"time_stddev\": %.6f,\n"
+           "   \"rate_median\": %.0f, \"rate_min\": %.0f, \"rate_stddev\": %.0f}%s\n",
+           b.w->name, impl_getName(), scheduler_name().c_str(), b.workers,
+           b.w->size, b.runs, b.valid ? "true" : "false", b.timeMedian,
+           b.timeMin, b.timeStddev, b.rateMedian, b.rateMin, b.rateStddev,
+           i + 1 < rows.size() ? "," : "");
+  }
+  if (benchConfig.json) printf("]\n");
+}
+
+// The sweep of one workload: the dfs row first, then par by workers.
+void printSweep(std::vector<bench_row> &rows, bool first, bool last) {
+  if (first && !benchConfig.json)
+    printf("workload,engine,workers,runs,valid,time_median,time_min,"
+           "time_stddev,rate_median,speedup,efficiency,speedup_seq,"
+           "efficiency_seq,overhead\n");
+  else if (first)
+    printf("[\n");
+  double ts = rows[0].timeMedian, t1 = rows[1].timeMedian;
+  for (size_t i = 0; i < rows.size(); i++) {
+    bench_row &b = rows[i];
+    const char *engine = b.seq ? "dfs" : "par";
+    double sp = t1 / b.timeMedian, sps = ts / b.timeMedian;
+    if (!benchConfig.json) {
+      printf("%s,%s,%d,%d,%d,%.6f,%.6f,%.6f,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+             b.w->name, engine, b.workers, b.runs, b.valid, b.timeMedian,
+             b.timeMin, b.timeStddev, b.rateMedian, sp, sp / b.workers, sps,
+             sps / b.workers, t1 / ts);
+      continue;
+    }
+    printf("  {\"workload\": \"%s\", \"engine\": \"%s\", \"workers\": %d,"
+           " \"runs\": %d, \"valid\": %s,\n   \"time_median\": %.6f,"
+           " \"time_min\": %.6f, \"time_stddev\": %.6f, \"rate_median\": %.0f,\n"
+           "   \"speedup\": %.3f, \"efficiency\": %.3f, \"speedup_seq\": %.3f,"
+           " \"efficiency_seq\": %.3f, \"overhead\": %.3f}%s\n", b.w->name,
+           engine, b.workers, b.runs, b.valid ? "true" : "false", b.timeMedian,
+           b.timeMin, b.timeStddev, b.rateMedian, sp, sp / b.workers, sps,
+           sps / b.workers, t1 / ts, (last && i + 1 == rows.size()) ? "" : ",");
+  }
+  if (last && benchConfig.json) printf("]\n");
+}
+
+// The timed runs of rows, as stored.
+std::vector<result_run> resultRuns(std::vector<bench_row> &rows, long set) {
+  static machine_info machine;
+  std::vector<result_run> runs;
+  for (bench_row &b : rows)
+    for (size_t i = 0; i < b.rates.size(); i++) {
+      result_run r;
+      r.set = set;
+      r.workload = b.w->name;
+      r.engine = b.seq ? "dfs" : "par";
+      r.scheduler = b.seq ? "none" : scheduler_name();
+      r.workers = b.workers;
+      r.revision = UTS_REVISION;
+      r.compiler = __VERSION__;
+      r.machine = machine.fingerprint;
+      r.cpu = machine.cpu;
+      r.seconds = b.times[i];
+      r.rate = b.rates[i];
+      runs.push_back(r);
+    }
+  return runs;
+}
+
+// Compare each row with its baseline, false on a regression.
+bool compareRuns(std::vector<bench_row> &rows, std::vector<result_run> &runs) {
+  results_store store = { benchConfig.compareFile };
+  std::vector<result_run> stored;
+  if (!store.read(stored)) impl_abort(1);
+
+  bool ok = true;
+  size_t k = 0;
+  for (bench_row &b : rows) {
+    const result_run &key = runs[k];
+    k += b.rates.size();
+    std::vector<double> base;
+    std::string from = results_baseline(stored, key, benchConfig.baseline, base);
+    fprintf(stderr, "%-6s %s %3d workers: ", key.workload.c_str(),
+            key.engine.c_str(), key.workers);
+    if (base.empty()) {
+      fprintf(stderr, "no baseline\n");
+      continue;
+    }
+    double baseMedian, baseMin, baseStddev;
+    summarize(base, baseMedian, baseMin, baseStddev);
+    double p = mannWhitneyLess(b.rates, base);
+    bool regression = p < benchConfig.level;
+    fprintf(stderr, "%.0f -> %.0f nodes/sec (%+.1f%%) against %zu runs of"
+            " %s, p = %.4f%s\n", baseMedian, b.rateMedian,
+            (b.rateMedian / baseMedian - 1.0) * 100.0, base.size(),
+            from.c_str(), p, regression ? ", REGRESSION" : "");
+    // 2 + 2 runs cannot reach p = 0.05, say so rather than pass quietly
+    if (mannWhitneyLess(std::vector<double>(b.rates.size(), 0.0),
+                        std::vector<double>(base.size(), 1.0)) >= benchConfig.level)
+      fprintf(stderr, "       too few runs to detect a regression at %.3g\n",
+              benchConfig.level);
+    ok = ok && !regression;
+  }
+  return ok;
+}
+
+// ===========================================================================
+
+int main(int argc, char *argv[]) {
+  UTSConfig config;
+  std::vector<const uts_workload *> selected;
+
+  argc = bench_parseParams(argc, argv);
+  uts_parseParams(&config, argc, argv);
+  if (benchConfig.workloads == NULL) {
+    fprintf(stderr, "*** No workloads given (-w), try -h for help\n");
+    impl_abort(4);
+  }
+  if (!uts_findWorkloads(benchConfig.workloads, selected))
+    impl_abort(4);
+  if (config.verbose > 0)
+    fprintf(stderr, "%s, %s scheduler, %d workers: %d warm-up and %d timed"
+            " runs per workload\n", impl_getName(), scheduler_name().c_str(),
+            num_workers(), benchConfig.warmup, benchConfig.reps);
+
+  long set = (long) time(NULL);
+  std::vector<bench_row> rows, all;
+  if (benchConfig.sweep.empty()) {
+    for (const uts_workload *w : selected)
+      all.push_back(runWorkload(*w, &config, false));
+    printRows(all);
+    fflush(stdout);
+  }
+
+  for (size_t i = 0; i < selected.size() && !benchConfig.sweep.empty(); i++) {
+    rows.assign(1, runWorkload(*selected[i], &config, true));
+    for (int p : benchConfig.sweep) {
+      set_num_workers(p);
+      rows.push_back(runWorkload(*selected[i], &config, false));
+    }
+    // rows are printed as each workload finishes, a sweep takes long
+    printSweep(rows, i == 0, i + 1 == selected.size());
+    fflush(stdout);
+    all.insert(all.end(), rows.begin(), rows.end());
+  }
+
+  bool valid = true;
+  for (bench_row &b : all) valid = valid && b.valid;
+  std::vector<result_run> runs = resultRuns(all, set);
+  bool regressed = false;
+  if (benchConfig.compareFile != NULL)
+    regressed = !compareRuns(all, runs);
+  if (benchConfig.appendFile != NULL) {
+    results_store store = { benchConfig.appendFile };
+    if (!valid)
+      fprintf(stderr, "*** Wrong trees, runs not added to %s\n", store.file);
+    else if (!store.append(runs))
+      impl_abort(1);
+  }
+
+  return !valid ? 1 : regressed ? 2 : 0;
+}
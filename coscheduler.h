@@ -0,0 +1,235 @@
+/* Fork-join tasks as C++20 coroutines, on a work-stealing executor.
+ *
+ * A task<T> is a lazily started coroutine returning a T. Awaiting
+ * when_all(tasks) pushes all but the first task onto the worker's deque
+ * and runs the first one in place. The parent then stays suspended until
+ * its last child finishes, and that child resumes it, on whichever worker
+ * ran it. Waiting for children never blocks a worker thread, and a task
+ * holds no native stack while it is suspended, only its frame.
+ *
+ * Frames come from per-worker pools with one free list per 64-byte size
+ * class. A frame freed on another worker than the one that allocated it
+ * moves to that worker's pool. Pools are never shrunk, so the memory a
+ * pool grew to is the high-water mark of the frames it had outstanding.
+ *
+ * Workers are started for one run and stop when the root task finishes.
+ * Idle workers spin and then yield while stealing; they never sleep.
+ */
+
+#pragma once
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <coroutine>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+
+// A coroutine ready to run, as held in the deques.
+struct co_frame {
+  int depth = 0;                  // unused, required by Deque
+  std::coroutine_handle<> handle;
+};
+
+// Per-worker frame pool and counters.
+struct alignas(64) co_worker_stats {
+  long long resumed = 0;          // tasks taken from a deque and run
+  long long spawned = 0;          // tasks created by when_all
+  long long steals = 0, failed_steals = 0;
+  long long fresh = 0, reused = 0, unpooled = 0;  // frame allocations
+  long long pool_bytes = 0;       // memory held by the pool
+  long long max_frame = 0;        // largest frame allocated
+};
+
+struct co_pool {
+  static constexpr size_t unit = 64;
+  static constexpr int classes = 32;    // frames up to 2 KB are pooled
+  void *free_list[classes] = {};
+  co_worker_stats *stats = nullptr;
+
+  void *alloc(size_t n) {
+    co_worker_stats &st = *stats;
+    if ((long long) n > st.max_frame) st.max_frame = n;
+    size_t c = (n + unit - 1) / unit;
+    if (c > classes) {
+      st.unpooled++;
+      return ::operator new(n);
+    }
+    void *p = free_list[c-1];
+    if (p != nullptr) {
+      free_list[c-1] = *(void **) p;
+      st.reused++;
+      return p;
+    }
+    st.fresh++;
+    st.pool_bytes += c * unit;
+    return ::operator new(c * unit);
+  }
+
+  void free(void *p, size_t n) {
+    size_t c = (n + unit - 1) / unit;
+    if (c > classes) {
+      ::operator delete(p);
+      return;
+    }
+    *(void **) p = free_list[c-1];
+    free_list[c-1] = p;
+  }
+};
+
+// Frames allocated outside a run (none, normally) go to this.
+inline co_worker_stats co_orphan_stats;
+inline thread_local co_pool co_local_pool = { {}, &co_orphan_stats };
+
+template <typename T>
+struct task {
+  struct promise_type;
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  struct promise_type : co_frame {
+    T value;
+    std::coroutine_handle<> parent;       // resumed by the last child
+    std::atomic<int> *pending = nullptr;  // siblings still running
+    std::atomic<bool> *finished = nullptr;  // the root's, instead
+
+    task get_return_object() {
+      handle = handle_type::from_promise(*this);
+      return task(handle_type::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct final_awaiter {
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(handle_type h) noexcept {
+        promise_type &p = h.promise();
+        if (p.pending == nullptr) {
+          p.finished->store(true, std::memory_order_release);
+          return std::noop_coroutine();
+        }
+        if (p.pending->fetch_sub(1, std::memory_order_acq_rel) == 1)
+          return p.parent;
+        return std::noop_coroutine();
+      }
+      void await_resume() noexcept {}
+    };
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void return_value(T v) { value = std::move(v); }
+    void unhandled_exception() { abort(); }
+
+    static void *operator new(size_t n) { return co_local_pool.alloc(n); }
+    static void operator delete(void *p, size_t n) { co_local_pool.free(p, n); }
+  };
+
+  handle_type h;
+
+  explicit task(handle_type h) : h(h) {}
+  task(task &&t) noexcept : h(t.h) { t.h = nullptr; }
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+  ~task() { if (h) h.destroy(); }
+
+  // only after the task finished
+  T &result() { return h.promise().value; }
+};
+
+struct co_executor;
+inline co_executor *co_current = nullptr;
+
+struct co_executor {
+  int num_workers;
+  std::vector<Deque<co_frame>> deques;
+  std::vector<co_worker_stats> stats;
+  std::atomic<bool> finished;
+  static inline thread_local int id = 0;
+
+  explicit co_executor(int n)
+      : num_workers(n), deques(n), stats(n), finished(false) {}
+
+  // Run root to completion on num_workers workers, the caller being
+  // worker 0, and return its result.
+  template <typename T>
+  T run(task<T> &root) {
+    co_current = this;
+    root.h.promise().finished = &finished;
+    std::vector<std::thread> threads;
+    for (int i = 1; i < num_workers; i++)
+      threads.emplace_back([this, i] { work(i); });
+    deques[0].push_bottom(&root.h.promise());
+    work(0);
+    for (auto &t : threads) t.join();
+    co_current = nullptr;
+    return root.result();
+  }
+
+  void push(co_frame *f) {
+    stats[id].spawned++;
+    deques[id].push_bottom(f);
+  }
+
+private:
+  void work(int i) {
+    id = i;
+    co_local_pool.stats = &stats[i];
+    size_t attempts = 0;
+    int idle = 0;
+    while (!finished.load(std::memory_order_acquire)) {
+      co_frame *f = deques[i].pop_bottom();
+      if (f == nullptr && num_workers > 1) {
+        int v = (i + 1 + (int) (hash64(((size_t) i << 32) + attempts++) %
+                                (num_workers - 1))) % num_workers;
+        f = deques[v].pop_top().first;
+        if (f != nullptr) stats[i].steals++;
+        else stats[i].failed_steals++;
+      }
+      if (f != nullptr) {
+        stats[i].resumed++;
+        f->handle.resume();
+        idle = 0;
+      } else if (++idle < 64) {
+        cpu_relax();
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    // the pool's free lists stay with this thread
+    co_local_pool.stats = &co_orphan_stats;
+  }
+
+  // splitmix64
+  static size_t hash64(size_t x) {
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+  }
+};
+
+// Awaiting this runs the tasks as children of the awaiting task, and
+// resumes it once they have all finished.
+template <typename T>
+struct when_all {
+  std::vector<task<T>> &tasks;
+  std::atomic<int> pending;
+
+  explicit when_all(std::vector<task<T>> &tasks) : tasks(tasks), pending(0) {}
+
+  bool await_ready() { return tasks.empty(); }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) {
+    pending.store((int) tasks.size(), std::memory_order_relaxed);
+    for (task<T> &t : tasks) {
+      t.h.promise().parent = parent;
+      t.h.promise().pending = &pending;
+    }
+    // the owner pops them in order, thieves take the last ones
+    for (size_t i = tasks.size() - 1; i >= 1; i--)
+      co_current->push(&tasks[i].h.promise());
+    co_current->stats[co_executor::id].spawned++;
+    return tasks[0].h;
+  }
+
+  void await_resume() {}
+};
@@ -11,13 +11,23 @@ int main(int argc, char *argv[]) {
   uts_printParams(&config);
   uts_initRoot(&config, &root);
 
+  if (perfCounters.enabled) perfCounters.start();
+  if (raplEnergy.enabled) raplEnergy.start();
   t1 = uts_wctime();
 
   Result r = treeSearch(&config, 0, &root);
 
   t2 = uts_wctime();
+  if (raplEnergy.enabled) raplEnergy.stop();
+  if (perfCounters.enabled) perfCounters.stop();
 
   uts_showStats(&config, 1, 0, t2-t1, r.size, r.leaves, r.maxdepth);
+  uts_showFingerprint(&config, r.fingerprint);
+  if (perfCounters.enabled) {
+    perfCounters.setNodes(getpid(), r.size);
+    perfCounters.print(stderr, r.size);
+  }
+  if (raplEnergy.enabled) raplEnergy.print(stderr, r.size);
 
   return 0;
 }
@@ -0,0 +1,350 @@
+/* Message passing between ranks on one machine, shared by par_dist and
+ * par_hybrid.
+ *
+ * Ranks are processes forked by rank 0 and connected pairwise by
+ * Unix-domain or loopback TCP sockets. Messages are a fixed header and an
+ * optional payload. A message is only handled once its sending time plus
+ * the injected link latency has passed.
+ *
+ * Termination is detected with Safra's token ring: every rank counts the
+ * work messages it sent minus those it received, and turns black when it
+ * receives work. An idle rank passes the token on with its count added.
+ * When a white token with a zero sum gets back to a white, idle rank 0,
+ * no work is left anywhere, and rank 0 tells the others to stop.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "uts.h"
+
+#define DIST_MAX_RANKS 256
+
+enum dist_transport_e { DIST_UNIX = 0, DIST_TCP };
+typedef enum dist_transport_e dist_transport_t;
+
+static const char * dist_transport_str[] = { "unix", "tcp" };
+
+// parse a transport name, -1 if unknown
+inline int dist_parseTransport(const char *s) {
+  for (int i = DIST_UNIX; i <= DIST_TCP; i++)
+    if (strcmp(s, dist_transport_str[i]) == 0) return i;
+  return -1;
+}
+
+enum dist_msg_e { MSG_STEAL = 0, MSG_WORK, MSG_TOKEN, MSG_DONE, MSG_RESULT };
+
+struct dist_header {
+  int32_t type;
+  int32_t count;      // MSG_WORK: nodes following, MSG_TOKEN: color
+  int64_t value;      // MSG_TOKEN: summed message counts
+  int64_t sentNs;     // for injected latency
+  int64_t bytes;      // payload following the header
+};
+
+// a node on the wire
+struct dist_node {
+  int32_t type;
+  int32_t height;
+  struct state_t state;
+};
+
+inline dist_node dist_pack(const Node &n) {
+  dist_node w;
+  w.type = n.type;
+  w.height = n.height;
+  w.state = n.state;
+  return w;
+}
+
+inline Node dist_unpack(const dist_node &w) {
+  Node n;
+  n.type = w.type;
+  n.height = w.height;
+  n.numChildren = -1;    // not yet determined
+  n.state = w.state;
+  return n;
+}
+
+struct dist_message {
+  int from;
+  dist_header h;
+  std::vector<char> payload;
+  long long dueNs;
+};
+
+inline long long dist_nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// splitmix64
+inline size_t dist_hash64(size_t x) {
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
+
+// A connected pair of sockets between two ranks.
+inline void dist_connect(dist_transport_t transport, int fd[2]) {
+  if (transport == DIST_UNIX) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) == 0) return;
+  } else {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int l = socket(AF_INET, SOCK_STREAM, 0);
+    fd[0] = socket(AF_INET, SOCK_STREAM, 0);
+    if (l >= 0 && fd[0] >= 0 &&
+        bind(l, (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        listen(l, 1) == 0 &&
+        getsockname(l, (struct sockaddr *) &addr, &len) == 0 &&
+        connect(fd[0], (struct sockaddr *) &addr, sizeof(addr)) == 0 &&
+        (fd[1] = accept(l, NULL, NULL)) >= 0) {
+      int one = 1;
+      setsockopt(fd[0], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      setsockopt(fd[1], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      close(l);
+      return;
+    }
+  }
+  fprintf(stderr, "*** Cannot connect ranks: %s\n", strerror(errno));
+  impl_abort(1);
+}
+
+// One rank's sockets to all the others.
+struct dist_link {
+  int id, ranks;
+  std::vector<int> fds;                   // to each other rank, -1 for self
+  std::vector<std::string> inbuf;         // partial messages, per rank
+  std::vector<bool> closed;               // peers that have hung up
+  std::deque<dist_message> arrived;       // waiting for their latency
+  long long latencyNs;
+  counter_t messages = 0, bytesSent = 0, bytesReceived = 0;
+
+  dist_link(int id, int ranks, std::vector<int> fds, double latencyUs)
+      : id(id), ranks(ranks), fds(fds), inbuf(ranks), closed(ranks, false),
+        latencyNs((long long) (latencyUs * 1000)) {}
+
+  void send(int to, int type, int count, long long value,
+            const void *payload = NULL, size_t bytes = 0) {
+    dist_header h = { type, count, value, dist_nowNs(), (int64_t) bytes };
+    std::string buf((const char *) &h, sizeof(h));
+    if (bytes > 0) buf.append((const char *) payload, bytes);
+    size_t off = 0;
+    while (off < buf.size()) {
+      ssize_t n = ::send(fds[to], buf.data() + off, buf.size() - off,
+                         MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && (errno == EPIPE || errno == ECONNRESET)) {
+        // the peer is done already, and so are we
+        closed[to] = true;
+        return;
+      }
+      if (n <= 0) {
+        fprintf(stderr, "*** Rank %d: lost connection to rank %d\n", id, to);
+        impl_abort(1);
+      }
+      off += n;
+    }
+    messages++;
+    bytesSent += buf.size();
+  }
+
+  // Read whatever has arrived, waiting up to timeoutMs, and pass the
+  // messages whose latency has passed to handle(dist_message &).
+  template <typename H>
+  void service(int timeoutMs, H handle) {
+    std::vector<struct pollfd> p;
+    for (int j = 0; j < ranks; j++)
+      if (j != id && !closed[j]) p.push_back({ fds[j], POLLIN, 0 });
+    if (!arrived.empty()) {
+      long long wait = arrived.front().dueNs - dist_nowNs();
+      timeoutMs = (int) min((long long) timeoutMs, max(0LL, wait / 1000000));
+    }
+    if (poll(p.data(), p.size(), timeoutMs) > 0) {
+      for (struct pollfd &q : p)
+        if (q.revents & (POLLIN | POLLHUP)) receive(q.fd);
+    }
+    long long now = dist_nowNs();
+    while (!arrived.empty() && arrived.front().dueNs <= now) {
+      dist_message m = std::move(arrived.front());
+      arrived.pop_front();
+      handle(m);
+    }
+  }
+
+  // a random rank other than ourselves
+  int randomPeer(size_t &attempts) {
+    size_t r = dist_hash64(((size_t) id << 32) + attempts++);
+    return (id + 1 + (int) (r % (ranks - 1))) % ranks;
+  }
+
+private:
+  void receive(int fd) {
+    int from = 0;
+    while (fds[from] != fd) from++;
+    char buf[65536];
+    ssize_t n = read(fd, buf, sizeof(buf));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) return;
+    if (n <= 0) {
+      // Peers hang up once they are done, which we may not have heard
+      // of yet with injected latency. A rank that dies fails the run
+      // when it is reaped.
+      closed[from] = true;
+      return;
+    }
+    bytesReceived += n;
+    std::string &in = inbuf[from];
+    in.append(buf, n);
+    size_t off = 0;
+    while (in.size() - off >= sizeof(dist_header)) {
+      dist_header h;
+      memcpy(&h, in.data() + off, sizeof(h));
+      if (in.size() - off < sizeof(h) + h.bytes) break;
+      dist_message m;
+      m.from = from;
+      m.h = h;
+      m.payload.assign(in.data() + off + sizeof(h),
+                       in.data() + off + sizeof(h) + h.bytes);
+      m.dueNs = h.sentNs + latencyNs;
+      // messages from one link arrive in order, and due in order
+      auto pos = arrived.end();
+      while (pos != arrived.begin() && (pos - 1)->dueNs > m.dueNs) pos--;
+      arrived.insert(pos, std::move(m));
+      off += sizeof(h) + h.bytes;
+    }
+    in.erase(0, off);
+  }
+};
+
+// Safra's termination detection, see above.
+struct dist_termination {
+  long long count = 0;                    // work messages sent - received
+  bool black = false;
+  bool haveToken = false;
+  bool tokenBlack = false;
+  long long tokenSum = 0;
+
+  void sentWork() { count++; }
+
+  void receivedWork() {
+    count--;
+    black = true;
+  }
+
+  void receivedToken(const dist_header &h) {
+    haveToken = true;
+    tokenBlack = h.count;
+    tokenSum = h.value;
+  }
+
+  // Idle, holding the token: pass it on, or at rank 0 decide. Returns
+  // true at rank 0 once the run is over and the others have been told.
+  bool pass(dist_link &link) {
+    haveToken = false;
+    if (link.id == 0) {
+      if (link.ranks == 1 || (!tokenBlack && !black && tokenSum + count == 0)) {
+        for (int j = 1; j < link.ranks; j++) link.send(j, MSG_DONE, 0, 0);
+        return true;
+      }
+      // start a new round
+      link.send(1, MSG_TOKEN, 0, 0);
+    } else {
+      link.send((link.id + 1) % link.ranks, MSG_TOKEN, tokenBlack || black,
+                tokenSum + count);
+    }
+    black = false;
+    return false;
+  }
+};
+
+// Final reduction: every rank's stats, at rank 0 (empty elsewhere).
+template <typename S>
+std::vector<S> dist_gather(dist_link &link, const S &mine) {
+  std::vector<S> all;
+  if (link.id != 0) {
+    link.send(0, MSG_RESULT, 0, 0, &mine, sizeof(mine));
+    return all;
+  }
+  all.resize(link.ranks);
+  all[0] = mine;
+  int in = 1;
+  while (in < link.ranks)
+    link.service(100, [&] (dist_message &m) {
+      if (m.h.type != MSG_RESULT) return;
+      memcpy(&all[m.from], m.payload.data(), sizeof(S));
+      in++;
+    });
+  return all;
+}
+
+// Fork ranks - 1 processes and connect all ranks pairwise. Each runs
+// body(link) and exits, while rank 0 runs it in the calling process and
+// returns once the others are reaped.
+template <typename F>
+void dist_launch(int ranks, dist_transport_t transport, double latencyUs,
+                 F body) {
+  // fd[i][j]: rank i's end of its link to rank j
+  std::vector<std::vector<int>> fd(ranks, std::vector<int>(ranks, -1));
+  for (int i = 0; i < ranks; i++)
+    for (int j = i + 1; j < ranks; j++) {
+      int pair[2];
+      dist_connect(transport, pair);
+      fd[i][j] = pair[0];
+      fd[j][i] = pair[1];
+    }
+
+  std::vector<pid_t> pids;
+  for (int id = 1; id < ranks; id++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "*** fork: %s\n", strerror(errno));
+      impl_abort(1);
+    }
+    if (pid == 0) {
+      for (int i = 0; i < ranks; i++)
+        for (int j = 0; j < ranks; j++)
+          if (i != id && fd[i][j] >= 0) close(fd[i][j]);
+      dist_link link(id, ranks, fd[id], latencyUs);
+      body(link);
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  for (int i = 1; i < ranks; i++)
+    for (int j = 0; j < ranks; j++)
+      if (fd[i][j] >= 0) close(fd[i][j]);
+
+  dist_link link(0, ranks, fd[0], latencyUs);
+  body(link);
+
+  for (pid_t pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "*** A rank failed, results are incomplete\n");
+      impl_abort(1);
+    }
+  }
+  for (int j = 1; j < ranks; j++) close(fd[0][j]);
+}
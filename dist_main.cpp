@@ -0,0 +1,26 @@
+#include "treesearchdist.h"
+
+// ===========================================================================
+
+int main(int argc, char *argv[]) {
+  UTSConfig config;
+  Node root;
+  double t1, t2;
+
+  uts_parseParams(&config, argc, argv);
+  uts_printParams(&config);
+  uts_initRoot(&config, &root);
+
+  t1 = uts_wctime();
+
+  Result r = treeSearch(&config, &root);
+
+  t2 = uts_wctime();
+
+  uts_showStats(&config, distConfig.ranks, distConfig.chunkSize, t2-t1,
+                r.size, r.leaves, r.maxdepth);
+  uts_showFingerprint(&config, r.fingerprint);
+  dist_showStats(&config);
+
+  return 0;
+}
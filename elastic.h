@@ -0,0 +1,95 @@
+/* Elastic worker scaling while a run is in progress.
+ *
+ * A watcher thread polls a control file holding the wanted number of
+ * active workers, and re-reads it whenever it changes ("-" for no file,
+ * signals only). SIGUSR1 and SIGUSR2 lower and raise the number of active
+ * workers by one. The scheduler parks the workers above the limit, so
+ * cores can be given back to other services without stopping a long run.
+ */
+
+#pragma once
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "parallel.h"
+#include "uts.h"
+
+// how often the control file and pending signals are checked
+#define ELASTIC_POLL_MS 100
+
+static std::atomic<int> elasticSignals(0);  // net change requested by signals
+
+extern "C" void elastic_onSignal(int sig) {
+  elasticSignals += (sig == SIGUSR2) ? 1 : -1;
+}
+
+struct elastic_control {
+  const char *path = NULL;
+  int active = 0;
+  struct timespec mtime = {0, 0};
+  bool stopping = false;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread watcher;
+
+  // returns false if the scheduler cannot change its worker count
+  bool start(const char *controlFile) {
+    path = strcmp(controlFile, "-") ? controlFile : NULL;
+    active = num_workers();
+    if (!set_active_workers(active)) return false;
+
+    signal(SIGUSR1, elastic_onSignal);
+    signal(SIGUSR2, elastic_onSignal);
+    watcher = std::thread([this] () {
+      std::unique_lock<std::mutex> lock(m);
+      while (!cv.wait_for(lock, std::chrono::milliseconds(ELASTIC_POLL_MS),
+                          [this] () {return stopping;}))
+        poll();
+    });
+    return true;
+  }
+
+  void stop() {
+    if (!watcher.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    cv.notify_all();
+    watcher.join();
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGUSR2, SIG_DFL);
+  }
+
+private:
+  void poll() {
+    int wanted = active + elasticSignals.exchange(0);
+
+    struct stat st;
+    if (path != NULL && stat(path, &st) == 0 &&
+        (st.st_mtim.tv_sec != mtime.tv_sec ||
+         st.st_mtim.tv_nsec != mtime.tv_nsec)) {
+      mtime = st.st_mtim;
+      FILE *f = fopen(path, "r");
+      int n;
+      if (f != NULL && fscanf(f, "%d", &n) == 1) wanted = n;
+      if (f != NULL) fclose(f);
+    }
+
+    wanted = max(1, min(wanted, num_workers()));
+    if (wanted != active) {
+      active = wanted;
+      set_active_workers(active);
+      fprintf(stderr, "*** Active workers: %d of %d\n", active, num_workers());
+    }
+  }
+};
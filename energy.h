@@ -0,0 +1,134 @@
+/* Energy of the timed search from the RAPL counters of the Linux powercap
+ * interface (/sys/class/powercap). Enabled with -E 1.
+ *
+ * The package domains (intel-rapl:N, also used for AMD) and their DRAM
+ * subdomains are read before and after the search; the core, uncore and
+ * psys domains are left out, as they overlap the package. Each counter
+ * wraps at its max_energy_range_uj, which is allowed for once, so runs
+ * long enough for a counter to wrap twice (minutes at full power) read
+ * low. Reported are the joules per domain and in total, the average power
+ * and nodes per joule. Without the interface, as in most VMs, or without
+ * permission to read energy_uj (root only on recent kernels), the reason
+ * is printed and the search runs as usual.
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "uts.h"
+
+#ifndef RAPL_ROOT
+#define RAPL_ROOT "/sys/class/powercap"
+#endif
+
+struct rapl_domain {
+  std::string name;       // package-0, dram, ...
+  std::string path;       // its directory
+  double rangeUj;         // the counter wraps here
+  double startUj, joules;
+};
+
+struct rapl_energy {
+  bool enabled = false;
+  std::vector<rapl_domain> domains;
+  std::string missing;    // why there is nothing to report
+  double seconds = 0.0;
+
+  // one number from a file of the domain, -1 if unreadable
+  static double readValue(const std::string &file, int *err = NULL) {
+    FILE *f = fopen(file.c_str(), "r");
+    double v = -1.0;
+    if (f == NULL) {
+      if (err != NULL) *err = errno;
+      return v;
+    }
+    if (fscanf(f, "%lf", &v) != 1) {
+      v = -1.0;
+      if (err != NULL) *err = EIO;
+    }
+    fclose(f);
+    return v;
+  }
+
+  static std::string readName(const std::string &dir) {
+    char buf[64] = "";
+    FILE *f = fopen((dir + "/name").c_str(), "r");
+    if (f != NULL && fgets(buf, sizeof(buf), f) == NULL) buf[0] = '\0';
+    if (f != NULL) fclose(f);
+    return std::string(buf, strcspn(buf, "\n"));
+  }
+
+  // Find the package and DRAM domains and read their counters.
+  void start() {
+    domains.clear();
+    missing.clear();
+    DIR *d = opendir(RAPL_ROOT);
+    if (d == NULL) {
+      missing = std::string(RAPL_ROOT ": ") + strerror(errno);
+      return;
+    }
+    int err = 0;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL) {
+      // intel-rapl:0 is a package, intel-rapl:0:1 one of its subdomains
+      int pkg, sub;
+      char end;
+      int n = sscanf(e->d_name, "intel-rapl:%d:%d%c", &pkg, &sub, &end);
+      if (n != 1 && n != 2) continue;
+      rapl_domain r;
+      r.path = std::string(RAPL_ROOT "/") + e->d_name;
+      r.name = readName(r.path);
+      if (n == 1 ? r.name.compare(0, 8, "package-") != 0 : r.name != "dram")
+        continue;
+      if (n == 2) r.name += "-" + std::to_string(pkg);
+      r.rangeUj = readValue(r.path + "/max_energy_range_uj");
+      r.startUj = readValue(r.path + "/energy_uj", &err);
+      r.joules = -1.0;
+      if (r.startUj >= 0.0) domains.push_back(r);
+    }
+    closedir(d);
+    if (domains.empty())
+      missing = err != 0 ? std::string("energy_uj: ") + strerror(err) +
+                           (err == EACCES ? " (readable by root only)" : "")
+                         : "no package or DRAM domains";
+    seconds = uts_wctime();
+  }
+
+  void stop() {
+    seconds = uts_wctime() - seconds;
+    for (rapl_domain &r : domains) {
+      double uj = readValue(r.path + "/energy_uj");
+      if (uj < 0.0) continue;
+      if (uj < r.startUj) uj += r.rangeUj;      // wrapped once
+      r.joules = (uj - r.startUj) * 1e-6;
+    }
+  }
+
+  void print(FILE *f, counter_t nodes) {
+    if (!missing.empty()) {
+      fprintf(f, "Energy (RAPL) not available: %s\n\n", missing.c_str());
+      return;
+    }
+    double total = 0.0;
+    fprintf(f, "Energy (RAPL):");
+    for (size_t i = 0; i < domains.size(); i++) {
+      rapl_domain &r = domains[i];
+      const char *sep = i > 0 ? "," : "";
+      if (r.joules < 0.0) fprintf(f, "%s %s = -", sep, r.name.c_str());
+      else fprintf(f, "%s %s = %.2f J", sep, r.name.c_str(), r.joules);
+      total += max(r.joules, 0.0);
+    }
+    fprintf(f, "\nEnergy = %.2f J, average power = %.1f W, %.0f nodes/J\n\n",
+            total, seconds > 0.0 ? total / seconds : 0.0,
+            total > 0.0 ? nodes / total : 0.0);
+  }
+};
+
+static rapl_energy raplEnergy;
@@ -0,0 +1,452 @@
+/* A continuation-stealing fork-join scheduler on user-level fibers, for
+ * plain g++/clang++ (no compiler support for spawn), configured from the
+ * environment:
+ *   NUM_THREADS         number of workers (default: the cpus we may run on)
+ *   UTS_FIBER_STACK_KB  stack size of a fiber (default 8192)
+ *
+ * par_do(left, right) is work-first, as in Cilk: the worker switches to a
+ * fresh fiber to run left, and leaves the fiber it came from, whose
+ * continuation will run right, at the bottom of its deque. When left
+ * returns and the continuation is still there, the worker pops it and
+ * switches back, which is the common case. If a thief took it meanwhile,
+ * right runs on the thief, and whichever of the two sides reaches the join
+ * last resumes the continuation there. The other one goes back to its
+ * worker's scheduler loop, which steals. A fiber that waits for a join is
+ * suspended, and never blocks its worker.
+ *
+ * Fibers have fixed-size stacks, mmap'ed with a guard page and reserved
+ * but not committed, so only the pages a fiber touched use memory. They
+ * are pooled per worker and never unmapped.
+ *
+ * Context switches save the callee-saved registers on the fiber's own
+ * stack, see uts_fiber_switch below; they are only written for x86-64.
+ * Workers spin and yield between steal attempts while a parallel region
+ * is running, and sleep outside of it.
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+#include "topology.h"
+
+// uts_fiber_switch(&from_sp, to_sp) suspends the running context, saving
+// its stack pointer in from_sp, and resumes the one saved at to_sp. A new
+// fiber starts in uts_fiber_start, which calls r13(r12) and never returns.
+extern "C" void uts_fiber_switch(void **from_sp, void *to_sp);
+extern "C" void uts_fiber_start();
+
+#if defined(__x86_64__)
+asm(R"(
+  .text
+  .weak uts_fiber_switch
+  .type uts_fiber_switch, @function
+uts_fiber_switch:
+  pushq %rbp
+  pushq %rbx
+  pushq %r12
+  pushq %r13
+  pushq %r14
+  pushq %r15
+  movq %rsp, (%rdi)
+  movq %rsi, %rsp
+  popq %r15
+  popq %r14
+  popq %r13
+  popq %r12
+  popq %rbx
+  popq %rbp
+  ret
+  .size uts_fiber_switch, .-uts_fiber_switch
+
+  .weak uts_fiber_start
+  .type uts_fiber_start, @function
+uts_fiber_start:
+  movq %r12, %rdi
+  callq *%r13
+  ud2
+  .size uts_fiber_start, .-uts_fiber_start
+)");
+#else
+#error "fibers.h: context switching is only implemented for x86-64"
+#endif
+
+struct fiber {
+  void *sp = nullptr;          // saved while the fiber is not running
+  char *stack = nullptr;       // lowest usable byte, null for thread stacks
+  int depth = 0;               // required by Deque
+  bool stolen = false;         // resumed by a thief at its last par_do
+  fiber *next = nullptr;       // in a pool
+
+  // Set up the stack so that switching to it calls f(arg).
+  void start(void (*f)(void *), void *arg, size_t size) {
+    void **top = (void **) (((uintptr_t) stack + size) & ~(uintptr_t) 15);
+    top[-1] = (void *) uts_fiber_start;
+    top[-2] = nullptr;         // rbp
+    top[-3] = nullptr;         // rbx
+    top[-4] = arg;             // r12
+    top[-5] = (void *) f;      // r13
+    top[-6] = nullptr;         // r14
+    top[-7] = nullptr;         // r15
+    sp = top - 7;
+  }
+};
+
+// a par_do waiting for its left branch, on the parent fiber's stack
+struct fiber_spawn {
+  void (*call)(void *);
+  void *left;
+  fiber *parent;
+  std::atomic<int> join;       // sides still running, once stolen
+};
+
+// what the context resumed by a switch does first, on behalf of the
+// context that was suspended
+enum fiber_post_e { POST_NONE = 0, POST_PUSH, POST_FREE, POST_JOIN };
+
+struct alignas(64) fiber_worker_stats {
+  long spawns = 0;             // par_do calls
+  long steals = 0, failed_steals = 0;
+  long joins = 0;              // stolen continuations that waited
+  long fibers = 0;             // allocated (never freed)
+};
+
+struct alignas(64) fiber_worker {
+  int id = 0;
+  Deque<fiber> deque;
+  fiber sched;                 // the scheduler loop, on the thread's stack
+  fiber *current = nullptr;
+  fiber *pool = nullptr;
+  std::vector<fiber *> owned;  // allocated here, for the stats
+  fiber_post_e post = POST_NONE;
+  fiber *post_fiber = nullptr;
+  std::atomic<int> *post_join = nullptr;
+  size_t attempts = 0;
+  fiber_worker_stats stats;
+};
+
+struct fiber_scheduler {
+  int num_threads;
+  size_t stack_size;
+  std::vector<fiber_worker> workers;
+  std::vector<std::thread> threads;
+  std::atomic<uint32_t> region;          // odd while one is running
+  std::atomic<bool> root_done, shutdown;
+  static inline thread_local fiber_worker *self_ = nullptr;
+
+  fiber_scheduler(int n, size_t stack_size)
+      : num_threads(n), stack_size(stack_size), workers(n), region(0),
+        root_done(false), shutdown(false) {
+    for (int i = 0; i < n; i++) workers[i].id = i;
+    for (int i = 1; i < n; i++)
+      threads.emplace_back([this, i] { worker_main(i); });
+  }
+
+  ~fiber_scheduler() {
+    shutdown = true;
+    region++;
+    futex_wake(&region, INT_MAX);
+    for (auto &t : threads) t.join();
+  }
+
+  // A fiber's code may resume on another thread after any switch, so
+  // the thread-local is never cached across one.
+  __attribute__((noinline)) static fiber_worker *self() { return self_; }
+
+  int worker_id() {
+    fiber_worker *w = self();
+    return w ? w->id : 0;
+  }
+
+  template <typename L, typename R>
+  void pardo(L &left, R &right) {
+    fiber_worker *w = self();
+    if (w == nullptr) {
+      run_root([&] { pardo(left, right); });
+      return;
+    }
+    fiber *parent = w->current;
+    fiber_spawn s;
+    s.call = [] (void *l) { (*(L *) l)(); };
+    s.left = &left;
+    s.parent = parent;
+    s.join.store(2, std::memory_order_relaxed);
+    w->stats.spawns++;
+
+    fiber *child = get_fiber(w);
+    child->start(child_main, &s, stack_size);
+    switch_to(w, child, POST_PUSH, parent);
+    // resumed by our child after left, or by a thief
+    w = self();
+    bool stolen = parent->stolen;
+    after_switch(w);
+
+    right();
+
+    if (stolen) {
+      // the last side to get here resumes us
+      w = self();
+      w->stats.joins++;
+      switch_to(w, &w->sched, POST_JOIN, parent, &s.join);
+      after_switch(self());
+    }
+  }
+
+  void reset_stats() {
+    for (fiber_worker &w : workers) {
+      long fibers = w.stats.fibers;
+      w.stats = fiber_worker_stats();
+      w.stats.fibers = fibers;
+    }
+  }
+
+  long long total_steals() {
+    long long n = 0;
+    for (fiber_worker &w : workers) n += w.stats.steals;
+    return n;
+  }
+
+  void print_stats(FILE *f) {
+    long page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> pages(stack_size / page + 1);
+    fprintf(f, "%6s %12s %10s %10s %10s %8s %12s\n", "worker", "spawns",
+            "steals", "failed", "joins", "fibers", "resident(KB)");
+    fiber_worker_stats t;
+    long resident = 0;
+    for (fiber_worker &w : workers) {
+      long r = 0;
+      for (fiber *fb : w.owned) {
+        if (mincore(fb->stack, stack_size, pages.data()) != 0) continue;
+        for (size_t i = 0; i < stack_size / page; i++) r += pages[i] & 1;
+      }
+      r *= page;
+      fiber_worker_stats &s = w.stats;
+      fprintf(f, "%6d %12ld %10ld %10ld %10ld %8ld %12.1f\n", w.id, s.spawns,
+              s.steals, s.failed_steals, s.joins, s.fibers, r / 1024.0);
+      t.spawns += s.spawns;
+      t.steals += s.steals;
+      t.failed_steals += s.failed_steals;
+      t.joins += s.joins;
+      t.fibers += s.fibers;
+      resident += r;
+    }
+    fprintf(f, "%6s %12ld %10ld %10ld %10ld %8ld %12.1f\n", "total",
+            t.spawns, t.steals, t.failed_steals, t.joins, t.fibers,
+            resident / 1024.0);
+    fprintf(f, "Fiber stacks: %ld x %zu KB reserved, %.1f KB resident\n",
+            t.fibers, stack_size / 1024, resident / 1024.0);
+  }
+
+ private:
+  // Run f in a root fiber, the calling thread acting as worker 0 until
+  // it is done.
+  template <typename F>
+  void run_root(F f) {
+    fiber_worker *w = &workers[0];
+    self_ = w;
+    w->current = &w->sched;
+    root_done = false;
+    region++;
+    futex_wake(&region, INT_MAX);
+
+    fiber *root = get_fiber(w);
+    struct root_call { F *f; fiber_scheduler *s; fiber *root; } rc = { &f, this, root };
+    root->start([] (void *arg) {
+      root_call *rc = (root_call *) arg;
+      after_switch(self());
+      (*rc->f)();
+      // once root_done is set, run_root may return and take rc with it
+      fiber *root = rc->root;
+      fiber_scheduler *s = rc->s;
+      s->root_done = true;
+      fiber_worker *w = self();
+      switch_to(w, &w->sched, POST_FREE, root);
+    }, &rc, stack_size);
+    run(w, root);
+    schedule(w);
+
+    region++;
+    self_ = nullptr;
+  }
+
+  static void child_main(void *arg) {
+    fiber_spawn *s = (fiber_spawn *) arg;
+    after_switch(self());
+    s->call(s->left);
+
+    fiber_worker *w = self();
+    fiber *me = w->current;
+    fiber *parent = s->parent;
+    // Our parent is the only thing that can be left in the deque: it
+    // was pushed right before us, and the rest was joined since.
+    if (w->deque.pop_bottom() != nullptr) {
+      switch_to(w, parent, POST_FREE, me);
+    } else if (s->join.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      switch_to(w, parent, POST_FREE, me);
+    } else {
+      switch_to(w, &w->sched, POST_FREE, me);
+    }
+    __builtin_unreachable();
+  }
+
+  static void switch_to(fiber_worker *w, fiber *to, fiber_post_e post,
+                        fiber *f, std::atomic<int> *join = nullptr) {
+    fiber *from = w->current;
+    w->post = post;
+    w->post_fiber = f;
+    w->post_join = join;
+    w->current = to;
+    uts_fiber_switch(&from->sp, to->sp);
+  }
+
+  // Finish what the suspended context asked for. Returns a fiber to
+  // resume, only for a join whose other side is done already.
+  static fiber *after_switch(fiber_worker *w) {
+    fiber_post_e post = w->post;
+    w->post = POST_NONE;
+    switch (post) {
+      case POST_PUSH:
+        w->post_fiber->stolen = false;
+        w->deque.push_bottom(w->post_fiber);
+        return nullptr;
+      case POST_FREE:
+        w->post_fiber->next = w->pool;
+        w->pool = w->post_fiber;
+        return nullptr;
+      case POST_JOIN:
+        if (w->post_join->fetch_sub(1, std::memory_order_acq_rel) == 1)
+          return w->post_fiber;
+        return nullptr;
+      default:
+        return nullptr;
+    }
+  }
+
+  fiber *get_fiber(fiber_worker *w) {
+    fiber *f = w->pool;
+    if (f != nullptr) {
+      w->pool = f->next;
+      return f;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    char *p = (char *) mmap(NULL, stack_size + page, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+                            MAP_STACK, -1, 0);
+    if (p == MAP_FAILED) {
+      perror("*** Cannot map a fiber stack");
+      abort();
+    }
+    mprotect(p, page, PROT_NONE);     // guard page
+    f = new fiber;
+    f->stack = p + page;
+    w->owned.push_back(f);
+    w->stats.fibers++;
+    return f;
+  }
+
+  // The scheduler loop of w, on its thread's own stack: steal
+  // continuations and run them, until the root is done.
+  void schedule(fiber_worker *w) {
+    int idle = 0;
+    while (!root_done.load(std::memory_order_acquire)) {
+      fiber *f = nullptr;
+      if (num_threads > 1) {
+        int v = (w->id + 1 + (int) (hash64(((size_t) w->id << 32) +
+                                           w->attempts++) %
+                                    (num_threads - 1))) % num_threads;
+        f = workers[v].deque.pop_top().first;
+        if (f != nullptr) w->stats.steals++;
+        else w->stats.failed_steals++;
+      }
+      if (f == nullptr) {
+        if (++idle < 64) cpu_relax();
+        else std::this_thread::yield();
+        continue;
+      }
+      idle = 0;
+      f->stolen = true;
+      run(w, f);
+    }
+  }
+
+  // Switch from the scheduler loop to f, and to whatever has to run
+  // next when the scheduler gets control back.
+  static void run(fiber_worker *w, fiber *f) {
+    while (f != nullptr) {
+      switch_to(w, f, POST_NONE, nullptr);
+      f = after_switch(w);
+    }
+  }
+
+  void worker_main(int id) {
+    fiber_worker *w = &workers[id];
+    self_ = w;
+    w->current = &w->sched;
+    uint32_t seen = 0;
+    while (true) {
+      uint32_t r = region.load(std::memory_order_acquire);
+      if (shutdown) return;
+      if ((r & 1) == 0 || r == seen) {
+        futex_wait(&region, r, SLEEP_TIMEOUT_NS);
+        continue;
+      }
+      seen = r;
+      schedule(w);
+    }
+  }
+
+  // splitmix64
+  static size_t hash64(size_t x) {
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+  }
+};
+
+struct fiber_fork_join {
+  std::unique_ptr<fiber_scheduler> sched;
+  int num_threads;
+  size_t stack_size = 8192 * 1024;
+
+  fiber_fork_join() {
+    const char *n = getenv("NUM_THREADS");
+    num_threads = (n != NULL && atoi(n) > 0) ? atoi(n) : topology().num_cpus();
+    const char *s = getenv("UTS_FIBER_STACK_KB");
+    if (s != NULL && atoi(s) > 0) stack_size = (size_t) atoi(s) * 1024;
+  }
+
+  fiber_scheduler &get() {
+    if (!sched) sched = std::make_unique<fiber_scheduler>(num_threads, stack_size);
+    return *sched;
+  }
+
+  int num_workers() { return num_threads; }
+
+  // restarts the workers on next use
+  void set_num_workers(int n) {
+    sched.reset();
+    num_threads = n;
+  }
+
+  template <typename F>
+  void parfor(long start, long end, F &f, long granularity) {
+    if (end - start <= granularity) {
+      for (long i = start; i < end; i++) f(i);
+      return;
+    }
+    long mid = start + (9 * (end - start + 1)) / 16;
+    auto l = [&] { parfor(start, mid, f, granularity); };
+    auto r = [&] { parfor(mid, end, f, granularity); };
+    get().pardo(l, r);
+  }
+};
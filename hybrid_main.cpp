@@ -0,0 +1,27 @@
+#include "treesearchhybrid.h"
+
+// ===========================================================================
+
+int main(int argc, char *argv[]) {
+  UTSConfig config;
+  Node root;
+  double t1, t2;
+
+  uts_parseParams(&config, argc, argv);
+  uts_printParams(&config);
+  uts_initRoot(&config, &root);
+
+  t1 = uts_wctime();
+
+  Result r = treeSearch(&config, &root);
+
+  t2 = uts_wctime();
+
+  uts_showStats(&config, hybridConfig.ranks * num_workers(),
+                hybridConfig.chunkSize, t2-t1,
+                r.size, r.leaves, r.maxdepth);
+  uts_showFingerprint(&config, r.fingerprint);
+  hybrid_showStats(&config, t2-t1);
+
+  return 0;
+}
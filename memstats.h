@@ -0,0 +1,63 @@
+/* How deep the native stack of each worker got during a search.
+ *
+ * The search calls note(worker) at its leaves, where the recursion is
+ * deepest, and the lowest frame address seen is kept per worker. Usage
+ * is measured from the top of the thread's stack, so it includes what
+ * the thread had below the search (the scheduler's frames). Frames on
+ * other stacks, as the fibers backend runs tasks on, are not counted:
+ * fibers.h reports its stacks itself. The peak RSS and the frontier
+ * high-water marks are in uts_memStats (uts.h).
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "uts.h"
+
+struct alignas(64) stack_mark {
+  char *top = NULL;                 // of the thread's stack, once seen
+  char *bottom = NULL;
+  char *low = (char *) UINTPTR_MAX; // lowest frame seen on it
+};
+
+struct stack_usage {
+  std::vector<stack_mark> marks;
+
+  stack_usage(int workers = 0) : marks(workers) {}
+  void reset(int workers) { marks.assign(workers, stack_mark()); }
+
+  // Only a frame deeper than any seen so far costs more than a compare.
+  inline void note(int w) {
+    char *sp = (char *) __builtin_frame_address(0);
+    stack_mark &m = marks[w];
+    if (sp >= m.low) return;
+    if (m.top == NULL) {
+      // once per worker: a worker stays on its thread
+      pthread_attr_t a;
+      void *addr = NULL;
+      size_t size = 0;
+      if (pthread_getattr_np(pthread_self(), &a) == 0) {
+        pthread_attr_getstack(&a, &addr, &size);
+        pthread_attr_destroy(&a);
+      }
+      m.bottom = (char *) addr;
+      m.top = (char *) addr + size;
+    }
+    if (sp >= m.bottom && sp < m.top) m.low = sp;
+  }
+
+  counter_t used(int w) const {
+    const stack_mark &m = marks[w];
+    return (m.low < m.top) ? (counter_t) (m.top - m.low) : 0;
+  }
+
+  counter_t deepest() const {
+    counter_t d = 0;
+    for (size_t w = 0; w < marks.size(); w++) d = max(d, used(w));
+    return d;
+  }
+};
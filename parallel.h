@@ -3,7 +3,12 @@
  */
 
 #pragma once
+#include <stdio.h>
 #include <iostream>
+#include <algorithm>
+#include <vector>
+
+#include "trace.h"
 
 static std::string scheduler_name();
 
@@ -11,6 +16,36 @@ static int num_workers();
 
 static int worker_id();
 
+// sets the number of workers, before any parallel work has started
+static void set_num_workers(int n);
+
+// elastic scaling: lets only n of the workers take part in the run
+// from now on, the others park until the limit is raised again.
+//    returns false if the scheduler cannot do this
+static bool set_active_workers(int n);
+// false while the calling worker is above the active limit and should
+// hand its work back to the scheduler
+static bool worker_active();
+
+// per-worker scheduler statistics since the last reset, for the
+// schedulers that keep any
+static void reset_scheduler_stats();
+static void print_scheduler_stats(FILE *f);
+// steals since the last reset, -1 if the scheduler does not count them
+static long long scheduler_steals();
+
+// Per-worker accounting since the last reset, for the run statistics
+// (runstats.h). Kept by the homegrown scheduler when built with UTS_STATS.
+struct worker_sched_stats {
+  long long tasks_run = 0;        // spawned tasks this worker executed
+  long long steal_attempts = 0, steals = 0;
+  double steal_time = 0.0;        // seconds in steal attempts
+  double idle_time = 0.0;         // seconds idle, besides stealing
+  double idle_for = 0.0;          // out of work for this long, 0 if busy
+};
+//    returns false if the scheduler does not keep them
+static bool scheduler_worker_stats(std::vector<worker_sched_stats> &s);
+
 // parallel loop from start (inclusive) to end (exclusive) running
 // function f.
 //    f should map long to void.
@@ -28,6 +63,24 @@ static void parallel_for(long start, long end, F f,
 template <typename Lf, typename Rf>
 static void par_do(Lf left, Rf right, bool conservative=false);
 
+// runs the thunks left and right in parallel and returns
+// combine(left(), right()).
+//    left and right should map void to T, combine maps (T, T) to T
+//    the two results are combined at the join, no shared atomics
+template <typename Lf, typename Rf, typename Cf>
+static auto par_do_reduce(Lf left, Rf right, Cf combine,
+			  bool conservative=false);
+
+// parallel reduction from start (inclusive) to end (exclusive),
+// combining f(i) for each i with combine, starting from identity.
+//    f should map long to T, combine maps (T, T) to T and must be
+//      associative
+//    granularity as in parallel_for
+template <typename F, typename T, typename Cf>
+static T parallel_reduce(long start, long end, F f, T identity, Cf combine,
+			 long granularity = 0,
+			 bool conservative = false);
+
 //***************************************
 
 // cilkplus
@@ -44,17 +97,24 @@ inline std::string scheduler_name() {
 
 inline int num_workers() {return __cilkrts_get_nworkers();}
 inline int worker_id() {return __cilkrts_get_worker_number();}
-inline void set_num_workers(int) {
-  throw std::runtime_error("don't know how to set worker count!");
+// only takes effect while the runtime is stopped, so shut it down first
+inline void set_num_workers(int n) {
+  __cilkrts_end_cilk();
+  std::stringstream ss; ss << n;
+  if (0 != __cilkrts_set_param("nworkers", ss.str().c_str()))
+    throw std::runtime_error("failed to set Cilk worker count!");
 }
-// Not sure this still works
-//__cilkrts_end_cilk();
-//  std::stringstream ss; ss << n;
-//  if (0 != __cilkrts_set_param("nworkers", ss.str().c_str()))
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() {}
+inline void print_scheduler_stats(FILE *) {}
+inline long long scheduler_steals() { return -1; }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
 
 
 template <typename Lf, typename Rf>
 inline void par_do(Lf left, Rf right, bool) {
+    UTS_TRACE_EV(trace_spawn(worker_id()));
     cilk_spawn right();
     left();
     cilk_sync;
@@ -89,6 +149,12 @@ inline std::string scheduler_name() {
 inline int num_workers() { return omp_get_max_threads(); }
 inline int worker_id() { return omp_get_thread_num(); }
 inline void set_num_workers(int n) { omp_set_num_threads(n); }
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() {}
+inline void print_scheduler_stats(FILE *) {}
+inline long long scheduler_steals() { return -1; }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
 
 template <class F>
 inline void parallel_for(long start, long end, F f,
@@ -102,6 +168,7 @@ bool in_par_do = false;
 
 template <typename Lf, typename Rf>
 inline void par_do(Lf left, Rf right, bool conservative) {
+  UTS_TRACE_EV(trace_spawn(worker_id()));
   if (!in_par_do) {
     in_par_do = true;  // at top level start up tasking
 #pragma omp parallel
@@ -140,11 +207,22 @@ bool taskparts_launched = false;
 
 inline int num_workers() { return taskparts::perworker::nb_workers(); }
 inline int worker_id() { return taskparts::perworker::my_id(); }
+// read by taskparts when it launches its workers
+inline void set_num_workers(int n) {
+  setenv("TASKPARTS_NUM_WORKERS", std::to_string(n).c_str(), 1);
+}
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() {}
+inline void print_scheduler_stats(FILE *) {}
+inline long long scheduler_steals() { return -1; }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
 
 using taskparts_scheduler = taskparts::bench_scheduler;
 
 template <typename Lf, typename Rf>
 inline void par_do(Lf left, Rf right, bool) {
+  UTS_TRACE_EV(trace_spawn(worker_id()));
   if (taskparts_launched) {
     taskparts::fork2join<Lf, Rf, taskparts_scheduler>(left, right);
   } else {
@@ -213,6 +291,153 @@ template <typename Benchmark,
   }, benchmark_setup, benchmark_teardown);
 }
 
+// homegrown work stealing
+#elif defined(HOMEGROWN)
+#include "scheduler.h"
+#define PAR_GRANULARITY 2000
+
+inline std::string scheduler_name() {
+  return "homegrown work stealing";
+}
+
+fork_join_scheduler fj;
+
+inline int num_workers() { return fj.num_workers(); }
+inline int worker_id() { return fj.worker_id(); }
+inline void set_num_workers(int n) { fj.set_num_workers(n); }
+inline bool set_active_workers(int n) { fj.get().set_active_workers(n); return true; }
+inline bool worker_active() { return fj.get().is_active(); }
+inline void reset_scheduler_stats() { fj.get().reset_stats(); }
+inline void print_scheduler_stats(FILE *f) { fj.get().print_stats(f); }
+inline long long scheduler_steals() { return fj.get().total_steals(); }
+
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &s) {
+#ifdef UTS_STATS
+  scheduler<WorkStealingJob> &sc = fj.get();
+  long now = now_ns();
+  s.assign(sc.num_workers(), worker_sched_stats());
+  for (int i = 0; i < sc.num_workers(); i++) {
+    auto &w = sc.worker(i);
+    long long steals = 0;
+    for (int l = 0; l < STEAL_LEVELS; l++) steals += w.steals[l];
+    long idle_ns = (long) (w.spin_ns + w.sleep_ns) - (long) w.idle_steal_ns;
+    if (w.idle_mark != 0) idle_ns += now - w.idle_mark;   // idle right now
+    s[i].tasks_run = w.jobs_run;
+    s[i].steals = steals;
+    s[i].steal_attempts = steals + w.failed_steals;
+    s[i].steal_time = w.steal_ns / 1e9;
+    s[i].idle_time = std::max(0L, idle_ns) / 1e9;
+    s[i].idle_for = w.idle_start ? (now - w.idle_start) / 1e9 : 0.0;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+template <class F>
+inline void parallel_for(long start, long end, F f,
+			 long granularity,
+			 bool conservative) {
+  if (end > start)
+    fj.parfor(start, end, f, granularity, conservative);
+}
+
+template <typename Lf, typename Rf>
+inline void par_do(Lf left, Rf right, bool conservative) {
+  UTS_TRACE_EV(trace_spawn(worker_id()));
+  fj.pardo(left, right, conservative);
+}
+
+template <typename Job>
+inline void parallel_run(Job job, int) { // num_threads=0) {
+  job();
+}
+
+// continuation stealing on fibers
+#elif defined(FIBERS)
+#include "fibers.h"
+#define PAR_GRANULARITY 2000
+
+inline std::string scheduler_name() {
+  return "continuation stealing on fibers";
+}
+
+fiber_fork_join ffj;
+
+inline int num_workers() { return ffj.num_workers(); }
+inline int worker_id() { return ffj.get().worker_id(); }
+inline void set_num_workers(int n) { ffj.set_num_workers(n); }
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() { ffj.get().reset_stats(); }
+inline void print_scheduler_stats(FILE *f) { ffj.get().print_stats(f); }
+inline long long scheduler_steals() { return ffj.get().total_steals(); }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
+
+template <class F>
+inline void parallel_for(long start, long end, F f,
+			 long granularity,
+			 bool) {
+  if (end <= start) return;
+  if (granularity == 0)
+    granularity = std::max(1L, (end - start) / (8 * (long) num_workers()));
+  ffj.parfor(start, end, f, granularity);
+}
+
+template <typename Lf, typename Rf>
+inline void par_do(Lf left, Rf right, bool) {
+  UTS_TRACE_EV(trace_spawn(worker_id()));
+  ffj.get().pardo(left, right);
+}
+
+template <typename Job>
+inline void parallel_run(Job job, int) { // num_threads=0) {
+  job();
+}
+
+// work sharing through one global queue
+#elif defined(CENTRAL)
+#include "sharedqueue.h"
+#define PAR_GRANULARITY 2000
+
+inline std::string scheduler_name() {
+  return "central queue";
+}
+
+central_fork_join cfj;
+
+inline int num_workers() { return cfj.num_workers(); }
+inline int worker_id() { return cfj.get().worker_id(); }
+inline void set_num_workers(int n) { cfj.set_num_workers(n); }
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() { cfj.get().reset_stats(); }
+inline void print_scheduler_stats(FILE *f) { cfj.get().print_stats(f); }
+inline long long scheduler_steals() { return -1; }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
+
+template <class F>
+inline void parallel_for(long start, long end, F f,
+			 long granularity,
+			 bool) {
+  if (end <= start) return;
+  if (granularity == 0)
+    granularity = std::max(1L, (end - start) / (8 * (long) num_workers()));
+  cfj.parfor(start, end, f, granularity);
+}
+
+template <typename Lf, typename Rf>
+inline void par_do(Lf left, Rf right, bool) {
+  UTS_TRACE_EV(trace_spawn(worker_id()));
+  cfj.get().pardo(left, right);
+}
+
+template <typename Job>
+inline void parallel_run(Job job, int) { // num_threads=0) {
+  job();
+}
+
 // c++
 #else
 
@@ -223,6 +448,12 @@ inline std::string scheduler_name() {
 inline int num_workers() { return 1;}
 inline int worker_id() { return 0;}
 inline void set_num_workers(int) { ; }
+inline bool set_active_workers(int) { return false; }
+inline bool worker_active() { return true; }
+inline void reset_scheduler_stats() {}
+inline void print_scheduler_stats(FILE *) {}
+inline long long scheduler_steals() { return -1; }
+inline bool scheduler_worker_stats(std::vector<worker_sched_stats> &) { return false; }
 #define PAR_GRANULARITY 1000
 
 template <class F>
@@ -245,3 +476,47 @@ inline void parallel_run(Job job, int) { // num_threads=0) {
 }
 
 #endif
+
+//***************************************
+
+// reductions, shared by all of the backends above
+
+template <typename Lf, typename Rf, typename Cf>
+inline auto par_do_reduce(Lf left, Rf right, Cf combine, bool conservative) {
+  using T = decltype(left());
+  // each side writes only its own slot, padded so that two siblings
+  // running on different workers do not share a cache line
+  struct alignas(64) slot { T v; };
+  slot l, r;
+  par_do([&] () {l.v = left();}, [&] () {r.v = right();}, conservative);
+  return combine(l.v, r.v);
+}
+
+template <typename F, typename T, typename Cf>
+inline T parallel_reduce_(long start, long end, F& f, const T& identity,
+			  Cf& combine, long granularity, bool conservative) {
+  if ((end - start) <= granularity) {
+    T acc = identity;
+    for (long i=start; i < end; i++) acc = combine(acc, f(i));
+    return acc;
+  }
+  long n = end-start;
+  long mid = (start + (9*(n+1))/16);
+  return par_do_reduce(
+    [&] () {return parallel_reduce_(start, mid, f, identity, combine,
+				    granularity, conservative);},
+    [&] () {return parallel_reduce_(mid, end, f, identity, combine,
+				    granularity, conservative);},
+    combine, conservative);
+}
+
+template <typename F, typename T, typename Cf>
+inline T parallel_reduce(long start, long end, F f, T identity, Cf combine,
+			 long granularity,
+			 bool conservative) {
+  if (end <= start) return identity;
+  if (granularity == 0)
+    granularity = std::max(1L, (end - start) / (8 * (long) num_workers()));
+  return parallel_reduce_(start, end, f, identity, combine,
+			  granularity, conservative);
+}
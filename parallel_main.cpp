@@ -11,13 +11,47 @@ int main(int argc, char *argv[]) {
   uts_printParams(&config);
   uts_initRoot(&config, &root);
 
+  elastic_control elastic;
+  if (parConfig.elasticFile != NULL && !elastic.start(parConfig.elasticFile)) {
+    fprintf(stderr, "*** Elastic mode is not supported by the %s scheduler\n",
+            scheduler_name().c_str());
+    impl_abort(1);
+  }
+
+  if (perfCounters.enabled) {
+    // start the workers, so that their threads are counted
+    par_do([] () {}, [] () {});
+    perfCounters.start();
+  }
+  progressMonitor.start(num_workers());
+  if (raplEnergy.enabled) raplEnergy.start();
   t1 = uts_wctime();
 
   Result r = treeSearch(&config, 0, &root);
 
   t2 = uts_wctime();
-
-  uts_showStats(&config, 1, 0, t2-t1, r.size, r.leaves, r.maxdepth);
+  if (raplEnergy.enabled) raplEnergy.stop();
+  if (perfCounters.enabled) perfCounters.stop();
+  progressMonitor.stop();
+  elastic.stop();
+
+  uts_showStats(&config, num_workers(), 0, t2-t1, r.size, r.leaves, r.maxdepth);
+  uts_showFingerprint(&config, r.fingerprint);
+  par_showStats(&config);
+  if (perfCounters.enabled) {
+#ifdef UTS_STATS
+    for (run_counts &c : runStats.counts) perfCounters.setNodes(c.tid, c.nodes);
+#endif
+    perfCounters.print(stderr, r.size);
+  }
+  if (raplEnergy.enabled) raplEnergy.print(stderr, r.size);
+#ifdef UTS_STATS
+  if (runStats.jsonFile != NULL)
+    runStats.writeJson(t2-t1, r.size, r.leaves, r.maxdepth);
+#endif
+#ifdef UTS_TRACE
+  if (tracer.file != NULL) tracer.write();
+#endif
 
   return 0;
 }
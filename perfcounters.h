@@ -0,0 +1,178 @@
+/* Hardware performance counters around the timed search, per thread,
+ * through perf_event_open(2). Enabled with -P 1.
+ *
+ * Every thread of the process when counting starts (so start the workers
+ * first) gets its own counters for cycles, instructions, cache misses,
+ * branch misses and reference cycles, all in user mode, plus its cpu
+ * time. Reported are IPC, misses per thousand instructions, the clock
+ * relative to the nominal one (cycles / ref-cycles, above 1 with turbo),
+ * and cycles, instructions and cpu time per node. Counters the kernel or the
+ * machine does not permit (no PMU in a VM, perf_event_paranoid) are
+ * shown as "-", and the search runs as usual.
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <vector>
+
+#include "uts.h"
+
+enum perf_counter_e { PERF_CYCLES = 0, PERF_INSTRUCTIONS, PERF_CACHE_MISSES,
+                      PERF_BRANCH_MISSES, PERF_REF_CYCLES, PERF_TASK_CLOCK,
+                      PERF_COUNTERS };
+
+static const struct { uint32_t type; uint64_t config; const char *name; }
+perf_counter_def[PERF_COUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES, "ref-cycles" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" },
+};
+
+// A thread's counters. Values are scaled up if the kernel had to
+// multiplex them, -1 if not available.
+struct perf_thread {
+  long tid;
+  int fd[PERF_COUNTERS];
+  double value[PERF_COUNTERS];
+  counter_t nodes;      // visited by this thread, if known
+};
+
+struct perf_counters {
+  bool enabled = false;
+  std::vector<perf_thread> threads;
+  int missing[PERF_COUNTERS] = {};   // errno of the first failed open
+
+  static int open_counter(long tid, int c) {
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size = sizeof(a);
+    a.type = perf_counter_def[c].type;
+    a.config = perf_counter_def[c].config;
+    a.disabled = 1;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                    PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int) syscall(SYS_perf_event_open, &a, (pid_t) tid, -1, -1, 0);
+  }
+
+  // Open and enable counters on every thread of the process.
+  void start() {
+    DIR *d = opendir("/proc/self/task");
+    struct dirent *e;
+    while (d != NULL && (e = readdir(d)) != NULL) {
+      if (e->d_name[0] == '.') continue;
+      perf_thread t;
+      t.tid = atol(e->d_name);
+      t.nodes = 0;
+      for (int c = 0; c < PERF_COUNTERS; c++) {
+        t.fd[c] = open_counter(t.tid, c);
+        t.value[c] = -1.0;
+        if (t.fd[c] < 0 && missing[c] == 0) missing[c] = errno;
+      }
+      threads.push_back(t);
+    }
+    if (d != NULL) closedir(d);
+    for (perf_thread &t : threads)
+      for (int c = 0; c < PERF_COUNTERS; c++)
+        if (t.fd[c] >= 0) {
+          ioctl(t.fd[c], PERF_EVENT_IOC_RESET, 0);
+          ioctl(t.fd[c], PERF_EVENT_IOC_ENABLE, 0);
+        }
+  }
+
+  void stop() {
+    for (perf_thread &t : threads)
+      for (int c = 0; c < PERF_COUNTERS; c++) {
+        if (t.fd[c] < 0) continue;
+        ioctl(t.fd[c], PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t v[3];      // value, time enabled, time running
+        if (read(t.fd[c], v, sizeof(v)) == sizeof(v))
+          t.value[c] = (v[2] == 0) ? 0.0 : v[0] * ((double) v[1] / v[2]);
+        close(t.fd[c]);
+        t.fd[c] = -1;
+      }
+  }
+
+  // Nodes visited by thread tid, for the per-node figures of its row.
+  void setNodes(long tid, counter_t nodes) {
+    for (perf_thread &t : threads)
+      if (t.tid == tid) t.nodes = nodes;
+  }
+
+  void print(FILE *f, counter_t nodes) {
+    if (threads.empty()) return;
+    fprintf(f, "Performance counters (user mode), per thread:\n");
+    for (int c = 0; c < PERF_COUNTERS; c++) {
+      if (missing[c] == 0) continue;
+      // usually all hardware counters fail alike
+      int same = c;
+      while (same + 1 < PERF_COUNTERS && missing[same + 1] == missing[c] &&
+             perf_counter_def[same + 1].type == perf_counter_def[c].type)
+        same++;
+      fprintf(f, "  %s%s not available: %s", perf_counter_def[c].name,
+              same > c ? " and others" : "", strerror(missing[c]));
+      if (missing[c] == EACCES || missing[c] == EPERM)
+        fprintf(f, " (see /proc/sys/kernel/perf_event_paranoid)");
+      fprintf(f, "\n");
+      c = same;
+    }
+    fprintf(f, "%8s %10s %10s %6s %10s %10s %8s %10s %10s %10s %10s\n", "tid",
+            "cycles(M)", "instr(M)", "IPC", "cmiss/ki", "bmiss/ki",
+            "cyc/ref", "cpu(ms)", "cyc/node", "ins/node", "ns/node");
+
+    perf_thread total;
+    total.tid = -1;
+    total.nodes = nodes;
+    for (int c = 0; c < PERF_COUNTERS; c++) total.value[c] = -1.0;
+    for (perf_thread &t : threads) {
+      // idle threads that never ran in the region add nothing
+      if (t.value[PERF_TASK_CLOCK] == 0.0) continue;
+      printRow(f, t);
+      for (int c = 0; c < PERF_COUNTERS; c++)
+        if (t.value[c] >= 0.0)
+          total.value[c] = max(total.value[c], 0.0) + t.value[c];
+    }
+    printRow(f, total);
+  }
+
+private:
+  // a / b, or "-" if either is unknown
+  static void col(FILE *f, double a, double b, double scale, int width,
+                  int prec) {
+    if (a < 0.0 || b <= 0.0) fprintf(f, " %*s", width, "-");
+    else fprintf(f, " %*.*f", width, prec, a / b * scale);
+  }
+
+  void printRow(FILE *f, perf_thread &t) {
+    const double *v = t.value;
+    if (t.tid < 0) fprintf(f, "%8s", "total");
+    else fprintf(f, "%8ld", t.tid);
+    col(f, v[PERF_CYCLES], 1e6, 1.0, 10, 1);
+    col(f, v[PERF_INSTRUCTIONS], 1e6, 1.0, 10, 1);
+    col(f, v[PERF_INSTRUCTIONS], v[PERF_CYCLES], 1.0, 6, 2);
+    col(f, v[PERF_CACHE_MISSES], v[PERF_INSTRUCTIONS], 1e3, 10, 3);
+    col(f, v[PERF_BRANCH_MISSES], v[PERF_INSTRUCTIONS], 1e3, 10, 3);
+    col(f, v[PERF_CYCLES], v[PERF_REF_CYCLES], 1.0, 8, 2);
+    col(f, v[PERF_TASK_CLOCK], 1e6, 1.0, 10, 1);
+    col(f, v[PERF_CYCLES], (double) t.nodes, 1.0, 10, 1);
+    col(f, v[PERF_INSTRUCTIONS], (double) t.nodes, 1.0, 10, 1);
+    col(f, v[PERF_TASK_CLOCK], (double) t.nodes, 1.0, 10, 1);
+    fprintf(f, "\n");
+  }
+};
+
+static perf_counters perfCounters;
@@ -0,0 +1,150 @@
+/* Live progress of a long search.
+ *
+ * Every worker counts the nodes it visits in a slot of its own, on its
+ * own cache line, with plain relaxed stores: the hot path never writes a
+ * line another worker writes. A monitor thread reads all slots every -i
+ * seconds and prints the nodes so far, the current and the average rate,
+ * and how many workers made progress since the last sample. With -M file
+ * it also rewrites file, in the Prometheus text format, for a local
+ * scraper (node_exporter's textfile collector, say). The file is replaced
+ * atomically, so readers never see half of it.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "uts.h"
+
+// sample every this many seconds if only a metrics file is asked for
+#define PROGRESS_DEFAULT_INTERVAL 10.0
+
+struct alignas(64) progress_slot {
+  std::atomic<counter_t> nodes{0};
+};
+
+struct progress_monitor {
+  double interval = 0.0;        // seconds, 0: off
+  const char *metricsFile = NULL;
+  bool on = false;
+  std::vector<progress_slot> slots;
+
+  double startTime = 0.0, lastTime = 0.0;
+  counter_t lastNodes = 0;
+  std::vector<counter_t> lastSlot;
+
+  bool stopping = false;
+  std::mutex m;
+  std::condition_variable cv;
+  std::thread monitor;
+
+  // the worker's own slot only, so a load and a store are enough
+  void countNode() {
+    if (!on) return;
+    std::atomic<counter_t> &n = slots[worker_id()].nodes;
+    n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+
+  void start(int workers) {
+    if (interval <= 0.0 && metricsFile == NULL) return;
+    if (interval <= 0.0) interval = PROGRESS_DEFAULT_INTERVAL;
+    slots = std::vector<progress_slot>(workers);
+    lastSlot.assign(workers, 0);
+    startTime = lastTime = uts_wctime();
+    lastNodes = 0;
+    stopping = false;
+    on = true;
+    monitor = std::thread([this] () {
+      std::unique_lock<std::mutex> lock(m);
+      while (!cv.wait_for(lock, std::chrono::duration<double>(interval),
+                          [this] () {return stopping;}))
+        sample(false);
+    });
+  }
+
+  // The metrics file is written once more, marked done.
+  void stop() {
+    if (!monitor.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(m);
+      stopping = true;
+    }
+    cv.notify_all();
+    monitor.join();
+    sample(true);
+    on = false;
+  }
+
+private:
+  void sample(bool done) {
+    double now = uts_wctime();
+    counter_t total = 0;
+    int active = 0;
+    std::vector<counter_t> cur(slots.size());
+    for (size_t i = 0; i < slots.size(); i++) {
+      cur[i] = slots[i].nodes.load(std::memory_order_relaxed);
+      total += cur[i];
+      if (cur[i] != lastSlot[i]) active++;
+    }
+    double rate = (now > lastTime) ? (total - lastNodes) / (now - lastTime) : 0.0;
+    double avg = (now > startTime) ? total / (now - startTime) : 0.0;
+
+    if (!done)
+      fprintf(stderr, "[%9.1f s] %llu nodes, %.0f nodes/sec now, %.0f average,"
+              " %d of %zu workers active\n", now - startTime, total, rate, avg,
+              active, slots.size());
+    if (metricsFile != NULL)
+      writeMetrics(now - startTime, total, rate, avg, active, cur, done);
+
+    lastTime = now;
+    lastNodes = total;
+    lastSlot = cur;
+  }
+
+  void writeMetrics(double elapsed, counter_t total, double rate, double avg,
+                    int active, std::vector<counter_t> &perWorker, bool done) {
+    std::string tmp = std::string(metricsFile) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (f == NULL) {
+      fprintf(stderr, "*** Cannot write metrics to %s\n", tmp.c_str());
+      return;
+    }
+    fprintf(f, "# HELP uts_nodes_total Tree nodes visited so far.\n"
+            "# TYPE uts_nodes_total counter\nuts_nodes_total %llu\n", total);
+    fprintf(f, "# HELP uts_nodes_per_second Nodes per second over the last"
+            " interval.\n# TYPE uts_nodes_per_second gauge\n"
+            "uts_nodes_per_second %.1f\n", rate);
+    fprintf(f, "# HELP uts_nodes_per_second_avg Nodes per second since the"
+            " start.\n# TYPE uts_nodes_per_second_avg gauge\n"
+            "uts_nodes_per_second_avg %.1f\n", avg);
+    fprintf(f, "# HELP uts_active_workers Workers that visited nodes in the"
+            " last interval.\n# TYPE uts_active_workers gauge\n"
+            "uts_active_workers %d\n", active);
+    fprintf(f, "# HELP uts_workers Workers of the run.\n# TYPE uts_workers"
+            " gauge\nuts_workers %zu\n", perWorker.size());
+    fprintf(f, "# HELP uts_elapsed_seconds Time since the search started.\n"
+            "# TYPE uts_elapsed_seconds gauge\nuts_elapsed_seconds %.1f\n",
+            elapsed);
+    fprintf(f, "# HELP uts_done Whether the search has finished.\n"
+            "# TYPE uts_done gauge\nuts_done %d\n", done ? 1 : 0);
+    fprintf(f, "# HELP uts_worker_nodes_total Nodes visited by each worker.\n"
+            "# TYPE uts_worker_nodes_total counter\n");
+    for (size_t i = 0; i < perWorker.size(); i++)
+      fprintf(f, "uts_worker_nodes_total{worker=\"%zu\"} %llu\n", i,
+              perWorker[i]);
+    if (fclose(f) != 0 || rename(tmp.c_str(), metricsFile) != 0)
+      fprintf(stderr, "*** Cannot write metrics to %s\n", metricsFile);
+  }
+};
+
+static progress_monitor progressMonitor;
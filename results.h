@@ -0,0 +1,230 @@
+/* A results store for regression tracking: an append-only text file with
+ * one line per timed run, tab-separated,
+ *   set workload engine scheduler workers revision compiler machine cpu
+ *   seconds nodes_per_sec
+ * where set identifies the invocation (its start time), revision is the
+ * git revision built (UTS_REVISION, set by the Makefile) and machine a
+ * fingerprint of the host: a hash of its name, cpu model, cpu count and
+ * memory size. Lines starting with # are comments.
+ *
+ * A new run set is compared with a baseline from the store, the runs of
+ * the same workload, engine, scheduler, worker count and machine from the
+ * latest set (or from a given revision), by a one-sided Mann-Whitney U
+ * test on nodes/sec: a regression is a significant shift towards lower
+ * rates.
+ */
+
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "uts.h"
+
+#ifndef UTS_REVISION
+#define UTS_REVISION "unknown"
+#endif
+
+// exact U distribution up to this many runs in both sets together
+#define RESULTS_EXACT_MAX 40
+
+struct result_run {
+  long set;
+  std::string workload, engine, scheduler;
+  int workers;
+  std::string revision, compiler, machine, cpu;
+  double seconds, rate;
+};
+
+// The host, as stored with every run.
+struct machine_info {
+  std::string fingerprint;    // 16 hex digits
+  std::string cpu;            // model, for people reading the store
+
+  machine_info() {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    cpu = "unknown";
+    long long memKB = 0;
+    char line[512];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    while (f != NULL && fgets(line, sizeof(line), f) != NULL) {
+      char *v = strchr(line, ':');
+      if (strncmp(line, "model name", 10) != 0 || v == NULL) continue;
+      for (v++; *v == ' '; v++) {}
+      cpu = std::string(v, strcspn(v, "\n"));
+      break;
+    }
+    if (f != NULL) fclose(f);
+    f = fopen("/proc/meminfo", "r");
+    if (f != NULL && fscanf(f, "MemTotal: %lld", &memKB) != 1) memKB = 0;
+    if (f != NULL) fclose(f);
+    for (char &c : cpu)
+      if (c == '\t') c = ' ';
+
+    // memory in GB, so that what the kernel reserves does not matter
+    char desc[1024];
+    snprintf(desc, sizeof(desc), "%s|%s|%ld|%lld", host, cpu.c_str(),
+             sysconf(_SC_NPROCESSORS_ONLN), (memKB + (1 << 19)) >> 20);
+    uint64_t h = 14695981039346656037ULL;     // FNV-1a
+    for (char *p = desc; *p != '\0'; p++) h = (h ^ (uint8_t) *p) * 1099511628211ULL;
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) h);
+    fingerprint = hex;
+  }
+};
+
+struct results_store {
+  const char *file;
+
+  // All runs in the store; false if it cannot be read.
+  bool read(std::vector<result_run> &runs) {
+    FILE *f = fopen(file, "r");
+    if (f == NULL) {
+      fprintf(stderr, "*** Cannot read results from %s\n", file);
+      return false;
+    }
+    char line[4096];
+    int n = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+      n++;
+      if (line[0] == '#' || line[0] == '\n') continue;
+      std::vector<std::string> col;
+      char *p = line;
+      while (true) {
+        size_t len = strcspn(p, "\t\n");
+        col.push_back(std::string(p, len));
+        if (p[len] != '\t') break;
+        p += len + 1;
+      }
+      if (col.size() != 11) {
+        fprintf(stderr, "*** %s:%d: malformed line, skipped\n", file, n);
+        continue;
+      }
+      result_run r;
+      r.set = atol(col[0].c_str());
+      r.workload = col[1];
+      r.engine = col[2];
+      r.scheduler = col[3];
+      r.workers = atoi(col[4].c_str());
+      r.revision = col[5];
+      r.compiler = col[6];
+      r.machine = col[7];
+      r.cpu = col[8];
+      r.seconds = atof(col[9].c_str());
+      r.rate = atof(col[10].c_str());
+      runs.push_back(r);
+    }
+    fclose(f);
+    return true;
+  }
+
+  bool append(const std::vector<result_run> &runs) {
+    FILE *f = fopen(file, "a");
+    if (f == NULL) {
+      fprintf(stderr, "*** Cannot append results to %s\n", file);
+      return false;
+    }
+    if (ftell(f) == 0)
+      fprintf(f, "# set\tworkload\tengine\tscheduler\tworkers\trevision\t"
+              "compiler\tmachine\tcpu\tseconds\tnodes_per_sec\n");
+    for (const result_run &r : runs)
+      fprintf(f, "%ld\t%s\t%s\t%s\t%d\t%s\t%s\t%s\t%s\t%.6f\t%.1f\n", r.set,
+              r.workload.c_str(), r.engine.c_str(), r.scheduler.c_str(),
+              r.workers, r.revision.c_str(), r.compiler.c_str(),
+              r.machine.c_str(), r.cpu.c_str(), r.seconds, r.rate);
+    return fclose(f) == 0;
+  }
+};
+
+// Same workload, engine, scheduler, workers and machine?
+inline bool results_sameKey(const result_run &a, const result_run &b) {
+  return a.workload == b.workload && a.engine == b.engine &&
+         a.scheduler == b.scheduler && a.workers == b.workers &&
+         a.machine == b.machine;
+}
+
+// Rates of the baseline runs for key: those of revision if given, else
+// those of the latest set. Returns the set or revision chosen.
+inline std::string results_baseline(const std::vector<result_run> &store,
+                                    const result_run &key,
+                                    const char *revision,
+                                    std::vector<double> &rates) {
+  long latest = -1;
+  for (const result_run &r : store)
+    if (results_sameKey(r, key) && revision == NULL) latest = max(latest, r.set);
+  for (const result_run &r : store)
+    if (results_sameKey(r, key) &&
+        (revision != NULL ? r.revision == revision : r.set == latest))
+      rates.push_back(r.rate);
+  if (revision != NULL) return revision;
+  for (const result_run &r : store)
+    if (r.set == latest) return r.revision;
+  return "";
+}
+
+/* One-sided Mann-Whitney U test of H1: x tends to be smaller than y.
+ * U counts the pairs with x < y (ties count a half); the p-value is
+ * P(U >= u) under H0, exact for small sets (ignoring ties), otherwise
+ * from the normal approximation with tie and continuity corrections.
+ */
+inline double mannWhitneyLess(const std::vector<double> &x,
+                              const std::vector<double> &y) {
+  size_t n1 = x.size(), n2 = y.size();
+  if (n1 == 0 || n2 == 0) return 1.0;
+  double u = 0.0;
+  for (double a : x)
+    for (double b : y) u += (a < b) ? 1.0 : (a == b) ? 0.5 : 0.0;
+
+  if (n1 + n2 <= RESULTS_EXACT_MAX) {
+    // c[i][j][k]: arrangements of i x's and j y's with k pairs x < y
+    size_t m = n1 * n2;
+    std::vector<double> prev((n2 + 1) * (m + 1), 0.0), cur(prev.size());
+    for (size_t j = 0; j <= n2; j++) prev[j * (m + 1)] = 1.0;   // i = 0
+    for (size_t i = 1; i <= n1; i++) {
+      std::fill(cur.begin(), cur.end(), 0.0);
+      cur[0] = 1.0;                                              // j = 0
+      for (size_t j = 1; j <= n2; j++)
+        for (size_t k = 0; k <= i * j; k++) {
+          // the largest value is an x (no pair added) or a y (adds i)
+          double v = prev[j * (m + 1) + k];
+          if (k >= i) v += cur[(j - 1) * (m + 1) + k - i];
+          cur[j * (m + 1) + k] = v;
+        }
+      std::swap(prev, cur);
+    }
+    double total = 0.0, tail = 0.0;
+    for (size_t k = 0; k <= m; k++) {
+      double c = prev[n2 * (m + 1) + k];
+      total += c;
+      if (k + 1e-9 >= u) tail += c;
+    }
+    return tail / total;
+  }
+
+  // tie correction from the pooled ranks
+  std::vector<double> all(x);
+  all.insert(all.end(), y.begin(), y.end());
+  std::sort(all.begin(), all.end());
+  double ties = 0.0, n = (double) (n1 + n2);
+  for (size_t i = 0; i < all.size(); ) {
+    size_t j = i;
+    while (j < all.size() && all[j] == all[i]) j++;
+    double t = (double) (j - i);
+    ties += t * t * t - t;
+    i = j;
+  }
+  double mean = n1 * n2 / 2.0;
+  double var = n1 * n2 / 12.0 * ((n + 1.0) - ties / (n * (n - 1.0)));
+  if (var <= 0.0) return 1.0;
+  double z = (u - mean - 0.5) / sqrt(var);
+  return 0.5 * erfc(z / sqrt(2.0));
+}
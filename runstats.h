@@ -0,0 +1,102 @@
+/* Per-worker run statistics of the parallel search, written as JSON with
+ * -J file ("-" for stdout), besides the usual summary.
+ *
+ * The search counts the nodes each worker visited, and the scheduler
+ * the tasks each one ran, its steal attempts, and its time spent
+ * stealing and idle (see scheduler_worker_stats in parallel.h). Working
+ * time is the rest of the run. The straggler tail is how long the first
+ * worker to run out of work for good had been idle when the search
+ * finished.
+ *
+ * All of it is only built with UTS_STATS (make par STATS=1); otherwise
+ * the counting compiles away and -J is not accepted.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <vector>
+
+#include "parallel.h"
+#include "uts.h"
+
+#ifdef UTS_STATS
+#define UTS_STAT(x) x
+#else
+#define UTS_STAT(x)
+#endif
+
+// Per-worker counts of the search itself.
+struct alignas(64) run_counts {
+  counter_t nodes = 0;        // visited
+  counter_t spawned = 0;      // children run as tasks
+  long tid = 0;               // thread of the worker, for perfcounters.h
+};
+
+struct run_stats {
+  std::vector<run_counts> counts;
+  std::vector<worker_sched_stats> sched;
+  bool haveSched = false;
+  const char *jsonFile = NULL;
+
+  void reset(int workers) { counts.assign(workers, run_counts()); }
+
+  void countNode() {
+    run_counts &c = counts[worker_id()];
+    c.nodes++;
+    if (c.tid == 0) c.tid = syscall(SYS_gettid);
+  }
+
+  // Take the scheduler's side as the search finishes.
+  void finish() { haveSched = scheduler_worker_stats(sched); }
+
+  bool writeJson(double walltime, counter_t size, counter_t leaves,
+                 counter_t maxdepth) {
+    FILE *f = strcmp(jsonFile, "-") ? fopen(jsonFile, "w") : stdout;
+    if (f == NULL) {
+      fprintf(stderr, "*** Cannot write statistics to %s\n", jsonFile);
+      return false;
+    }
+
+    double tail = 0.0;
+    for (size_t i = 0; haveSched && i < counts.size(); i++)
+      if (counts[i].nodes > 0) tail = max(tail, sched[i].idle_for);
+
+    fprintf(f, "{\n  \"engine\": \"%s\",\n  \"scheduler\": \"%s\",\n",
+            impl_getName(), scheduler_name().c_str());
+    fprintf(f, "  \"workers\": %d,\n  \"walltime\": %.6f,\n", num_workers(),
+            walltime);
+    fprintf(f, "  \"nodes\": %llu,\n  \"leaves\": %llu,\n  \"maxdepth\": %llu,\n",
+            size, leaves, maxdepth);
+    if (haveSched)
+      fprintf(f, "  \"straggler_tail\": %.6f,\n", tail);
+    else
+      fprintf(f, "  \"straggler_tail\": null,\n");
+    fprintf(f, "  \"per_worker\": [\n");
+    for (size_t i = 0; i < counts.size(); i++) {
+      fprintf(f, "    {\"worker\": %zu, \"nodes\": %llu, \"tasks_spawned\": %llu",
+              i, counts[i].nodes, counts[i].spawned);
+      if (haveSched) {
+        worker_sched_stats &s = sched[i];
+        double work = max(0.0, walltime - s.steal_time - s.idle_time);
+        fprintf(f, ", \"tasks_run\": %lld, \"steal_attempts\": %lld,"
+                " \"steals\": %lld, \"work_time\": %.6f, \"steal_time\": %.6f,"
+                " \"idle_time\": %.6f", s.tasks_run, s.steal_attempts,
+                s.steals, work, s.steal_time, s.idle_time);
+      } else {
+        fprintf(f, ", \"tasks_run\": null, \"steal_attempts\": null,"
+                " \"steals\": null, \"work_time\": null, \"steal_time\": null,"
+                " \"idle_time\": null");
+      }
+      fprintf(f, "}%s\n", i + 1 < counts.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) fclose(f);
+    return true;
+  }
+};
+
+static run_stats runStats;
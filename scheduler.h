@@ -0,0 +1,1034 @@
+/* This file is adapted from the CMU Problem-Based Benchmark Suite,
+ * https://github.com/cmuparlay/pbbslib
+ *
+ * A work-stealing fork-join scheduler, configured from the environment:
+ *   NUM_THREADS  number of workers (default: the cpus we may run on)
+ *   UTS_PIN      thread pinning: none, compact, scatter or cores
+ *                (default none, see topology.h)
+ *   UTS_SPIN_US  how long an idle worker spins before yielding (default 50)
+ *   UTS_YIELD_US how long it then yields before sleeping (default 200)
+ *   UTS_VICTIM   random, roundrobin or last (default random)
+ *   UTS_STEAL    one or half (default one)
+ *   UTS_PREFER   oldest or height (default oldest)
+ *   UTS_RECORD   file to log every steal to (see steallog.h)
+ *   UTS_REPLAY   steal log of an earlier run, whose steals to enforce
+ * Pinned workers steal hierarchically: from workers sharing their L3
+ * domain first, then from their own socket, then from remote sockets.
+ *
+ * An idle worker spins with exponential backoff between steal attempts,
+ * then yields its cpu, then sleeps on a futex of its own. A push wakes one
+ * sleeping worker, and a thief finishing a stolen job wakes its owner if it
+ * went to sleep waiting for it. With more workers than cpus, spinning only
+ * keeps the workers holding work off the cpus, so it is skipped.
+ *
+ * The number of active workers can be changed while running. A worker
+ * above the limit stops at its next fork, leaves the jobs it holds to the
+ * active workers, and sleeps until it is reactivated.
+ *
+ * Recording logs each steal, as the thief, the victim, and the spawn path
+ * of the job, in memory per worker, and writes the logs out when the
+ * scheduler stops. Replaying gives every job in the log to its thief's
+ * mailbox at spawn and runs all other jobs where they were spawned, so
+ * each job runs on the worker it ran on when recorded. There is no
+ * stealing then: idle workers take jobs from their mailbox instead. The
+ * order in which a worker runs its jobs is not enforced.
+ *
+ * Built with UTS_STATS, workers also count the jobs they run, time their
+ * steal attempts, and note when they last ran out of work, for the run
+ * statistics of the tree searches (see runstats.h). Built with UTS_TRACE,
+ * they record their steals and idle periods for the timeline (trace.h).
+ */
+
+#pragma once
+
+#include <assert.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "steallog.h"
+#include "topology.h"
+#include "trace.h"
+
+// Sleeping on a 32-bit word, see futex(2). A sleeper also wakes up after
+// timeout_ns, as a safety net; it rechecks its condition either way.
+inline void futex_wait(std::atomic<uint32_t> *word, uint32_t val,
+                       long timeout_ns) {
+  struct timespec ts = { timeout_ns / 1000000000L, timeout_ns % 1000000000L };
+  syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, val, &ts, NULL, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t> *word, int n) {
+  syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+inline long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// tell the cpu (and an SMT sibling) that we are spinning
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+// Deque from Arora, Blumofe, and Plaxton (SPAA, 1998).
+template <typename Job>
+struct Deque {
+  using qidx = unsigned int;
+  using tag_t = unsigned int;
+
+  // use std::atomic<age_t> for atomic access.
+  // Note: Explicit alignment specifier required
+  // to ensure that Clang inlines atomic loads.
+  struct alignas(int64_t) age_t {
+    tag_t tag;
+    qidx top;
+  };
+
+  // one slot per nested par_do on the owner's stack
+  static constexpr int q_size = 8192;
+  alignas(64) std::atomic<qidx> bot;
+  alignas(64) std::atomic<age_t> age;
+  std::vector<std::atomic<Job*>> deq;
+  std::vector<std::atomic<int>> depth;  // job depths, for peeking thieves
+
+  Deque() : bot(0), age(age_t{0, 0}), deq(q_size), depth(q_size) {}
+
+  void push_bottom(Job* job) {
+    auto local_bot = bot.load(std::memory_order_relaxed);      // atomic load
+    deq[local_bot].store(job, std::memory_order_relaxed);      // shared store
+    depth[local_bot].store(job->depth, std::memory_order_relaxed);
+    local_bot += 1;
+    if (local_bot == q_size) {
+      throw std::runtime_error("internal error: scheduler queue overflow");
+    }
+    bot.store(local_bot, std::memory_order_relaxed);  // shared store
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // returns the stolen job, if any, and whether more jobs were left
+  std::pair<Job*, bool> pop_top() {
+    Job* result = nullptr;
+    auto old_age = age.load(std::memory_order_relaxed);    // atomic load
+    auto local_bot = bot.load(std::memory_order_relaxed);  // atomic load
+    if (local_bot > old_age.top) {
+      auto job = deq[old_age.top].load(std::memory_order_relaxed);  // atomic load
+      auto new_age = old_age;
+      new_age.top = new_age.top + 1;
+      if (age.compare_exchange_strong(old_age, new_age))
+        result = job;
+      else
+        result = nullptr;
+      return {result, (local_bot > old_age.top + 1)};
+    } else
+      return {nullptr, false};
+  }
+
+  Job* pop_bottom() {
+    Job* result = nullptr;
+    auto local_bot = bot.load(std::memory_order_relaxed);  // atomic load
+    if (local_bot != 0) {
+      local_bot--;
+      bot.store(local_bot, std::memory_order_relaxed);  // shared store
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto job = deq[local_bot].load(std::memory_order_relaxed);  // atomic load
+      auto old_age = age.load(std::memory_order_relaxed);         // atomic load
+      if (local_bot > old_age.top)
+        result = job;
+      else {
+        bot.store(0, std::memory_order_relaxed);  // shared store
+        auto new_age = age_t{old_age.tag + 1, 0};
+        if ((local_bot == old_age.top) &&
+            age.compare_exchange_strong(old_age, new_age))
+          result = job;
+        else {
+          age.store(new_age, std::memory_order_relaxed);  // shared store
+          result = nullptr;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+      }
+    }
+    return result;
+  }
+
+  bool empty() { return size() == 0; }
+
+  // Racy hints for thieves: jobs left, and the depth of the oldest one
+  // (INT_MAX if none).
+  int size() {
+    int n = (int) bot.load(std::memory_order_relaxed) -
+            (int) age.load(std::memory_order_relaxed).top;
+    return std::max(n, 0);
+  }
+
+  int top_depth() {
+    auto top = age.load(std::memory_order_relaxed).top;
+    if (bot.load(std::memory_order_relaxed) <= top) return INT_MAX;
+    return depth[top].load(std::memory_order_relaxed);
+  }
+};
+
+struct WorkStealingJob {
+  WorkStealingJob() { done.store(false, std::memory_order_relaxed); }
+  virtual ~WorkStealingJob() = default;
+  void operator()() {
+    assert(done.load(std::memory_order_relaxed) == false);
+    execute();
+    done.store(true, std::memory_order_release);
+  }
+  bool finished() { return done.load(std::memory_order_acquire); }
+  virtual void execute() = 0;
+  std::atomic<bool> done;
+  int owner = 0;      // worker that spawned it, woken when a thief is done
+  int depth = 0;      // fork nesting depth, the root computation being 0
+  uint64_t path = 0;  // spawn path, when recording or replaying
+};
+
+template <typename F>
+struct JobImpl : WorkStealingJob {
+  JobImpl(F& f) : WorkStealingJob(), f(f) {}
+  void execute() override { f(); }
+  F& f;
+};
+
+template <typename F>
+JobImpl<F> make_job(F& f) { return JobImpl<F>(f); }
+
+// how far a thief went to find work, with pinned workers
+enum steal_level_e { STEAL_LLC = 0, STEAL_SOCKET, STEAL_REMOTE, STEAL_LEVELS };
+
+/* Steal policies, always applied nearest level first
+ *   victim: random, roundrobin, or last (the last successful victim
+ *           first, then random).
+ *   amount: one job, or half the jobs in the victim's deque.
+ *   prefer: oldest (the top of the chosen victim's deque), or height:
+ *           peek at the oldest job of a few victims and take the one
+ *           nearest the root. Jobs know their fork depth, which grows
+ *           with the height of the tree node that forked them.
+ */
+enum steal_victim_e { VICTIM_RANDOM = 0, VICTIM_ROUND_ROBIN, VICTIM_LAST };
+enum steal_amount_e { STEAL_ONE = 0, STEAL_HALF };
+enum steal_prefer_e { PREFER_OLDEST = 0, PREFER_HEIGHT };
+
+static const char * steal_victim_str[] = { "random", "roundrobin", "last" };
+static const char * steal_amount_str[] = { "one", "half" };
+static const char * steal_prefer_str[] = { "oldest", "height" };
+
+// victims peeked at per steal attempt, with PREFER_HEIGHT
+#define STEAL_PEEK 4
+// most jobs taken by one steal, with STEAL_HALF
+#define STEAL_HALF_MAX 64
+
+// index of s among n names (or a number), -1 if unknown
+inline int parse_name(const char *s, const char **names, int n) {
+  for (int i = 0; i < n; i++)
+    if (strcmp(s, names[i]) == 0) return i;
+  if (s[0] >= '0' && s[0] < '0' + n && s[1] == '\0') return s[0] - '0';
+  return -1;
+}
+
+// safety net for lost wakeups, see futex_wait
+#define SLEEP_TIMEOUT_NS 100000000L
+
+struct scheduler_options {
+  int num_threads = 1;
+  pin_policy_t pinning = PIN_NONE;
+  long spin_us = 50;     // spinning phase of an idle worker
+  long yield_us = 200;   // yielding phase, before it sleeps
+  int victim = VICTIM_RANDOM;
+  int amount = STEAL_ONE;
+  int prefer = PREFER_OLDEST;
+  const char *record = nullptr;  // steal log to write
+  const char *replay = nullptr;  // steal log to enforce
+};
+
+template <typename Job>
+struct scheduler {
+ public:
+  int num_threads;
+  pin_policy_t pinning;
+
+  static inline thread_local int thread_id = 0;
+  static inline thread_local int fork_depth = 0;
+  static inline thread_local uint64_t fork_path = STEAL_PATH_ROOT;
+
+  // jobs are tracked by spawn path, to record or replay steals
+  bool tracing;
+
+  // Per-worker counters, written only by their owner.
+  struct alignas(64) worker_stats {
+    unsigned long long steals[STEAL_LEVELS] = {};
+    unsigned long long failed_steals = 0;
+    unsigned long long stolen = 0;        // jobs taken by those steals
+    unsigned long long stolen_depth = 0;  // summed depth of stolen jobs
+    unsigned long long spin_ns = 0;     // spinning and yielding while idle
+    unsigned long long sleep_ns = 0;
+    unsigned long long sleeps = 0;
+    unsigned long long wakeups = 0;     // sleeps ended by another worker
+    unsigned long long wake_ns = 0;     // summed wakeup latency
+    unsigned long long max_wake_ns = 0;
+    unsigned long long replayed = 0;    // spawns found in the replayed log
+#ifdef UTS_STATS
+    unsigned long long jobs_run = 0;    // spawned jobs, wherever taken from
+    unsigned long long steal_ns = 0;    // in steal attempts
+    unsigned long long idle_steal_ns = 0;  // of which while idle
+    long idle_start = 0;                // out of work since, 0 if busy
+    long idle_mark = 0;                 // idle since, not counted yet
+#endif
+  };
+
+  scheduler(const scheduler_options &opts)
+      : num_threads(opts.num_threads),
+        pinning(opts.pinning),
+        deques(num_threads),
+        workers(num_threads),
+        stats(num_threads),
+        sleepers(num_threads),
+        active_limit(num_threads),
+        num_sleeping(0),
+        finished_flag(false),
+        victim(opts.victim),
+        amount(opts.amount),
+        prefer(opts.prefer),
+        record(opts.record),
+        replay(opts.replay),
+        steal_logs(num_threads),
+        mailboxes(num_threads),
+        start_ns(now_ns()) {
+    if (replay != nullptr && !load_replay()) replay = nullptr;
+    tracing = (record != nullptr || replay != nullptr);
+    place_workers();
+    // Oversubscribed, a spinning worker takes a cpu from one with work.
+    oversubscribed = num_threads > topo.num_cpus();
+    spin_ns = oversubscribed ? 0 : opts.spin_us * 1000;
+    yield_ns = opts.yield_us * 1000;
+
+    // Stopping condition
+    auto finished = [&]() { return finished_flag.load() == 1; };
+
+    // Spawn num_threads many threads on startup
+    thread_id = 0;  // thread-local write
+    pin(0);
+    for (int i = 1; i < num_threads; i++) {
+      spawned_threads.emplace_back([&, i, finished]() {
+        thread_id = i;  // thread-local write
+        pin(i);
+        start(finished);
+      });
+    }
+  }
+
+  ~scheduler() {
+    finished_flag = 1;
+    wake_all();
+    for (auto &t : spawned_threads) t.join();
+    if (record != nullptr) steal_log_write(record, steal_logs);
+  }
+
+  // Push onto local stack, and wake a sleeping worker to steal it. The
+  // job is the left (side 0) or right (side 1) branch of a par_do. When
+  // replaying, a job stolen in the recorded run goes to its thief instead,
+  // and false is returned.
+  bool spawn(Job* job, int side = 1) {
+    int id = worker_id();
+    job->owner = id;
+    job->depth = fork_depth + 1;
+    if (tracing) {
+      job->path = steal_path_child(fork_path, side);
+      if (replay != nullptr) {
+        auto it = replay_to.find(job->path);
+        if (it != replay_to.end()) {
+          stats[id].replayed++;
+          if (it->second != id) {
+            mail(it->second, job);
+            return false;
+          }
+        }
+      }
+    }
+    deques[id].push_bottom(job);
+    if (num_sleeping.load() > 0) wake_one(id);
+    return true;
+  }
+
+  // Run a job taken from a deque, at its own fork depth.
+  void run(Job* job) {
+    int owner = job->owner;
+    int depth = fork_depth;
+    uint64_t path = fork_path;
+    fork_depth = job->depth;
+    if (tracing) fork_path = job->path;
+#ifdef UTS_STATS
+    stats[worker_id()].jobs_run++;
+#endif
+    (*job)();
+    fork_depth = depth;
+    fork_path = path;
+    // the owner may have gone to sleep waiting for this job
+    if (owner != worker_id()) wake(owner);
+  }
+
+  // Wait for condition: finished().
+  template <typename F>
+  void wait(F finished, bool conservative = false) {
+    // Conservative avoids deadlock if scheduler is used in conjunction
+    // with user locks enclosing a wait.
+    if (conservative)
+      while (!finished()) std::this_thread::yield();
+    // If not conservative, schedule within the wait.
+    // Can deadlock if a stolen job uses same lock as encloses the wait.
+    else
+      start(finished);
+  }
+
+  // Pop from local stack.
+  Job* try_pop() {
+    return deques[worker_id()].pop_bottom();
+  }
+
+  int num_workers() { return num_threads; }
+  int worker_id() { return thread_id; }
+
+  // a spawned job popped back and run by its owner
+  void ran_inline() {
+#ifdef UTS_STATS
+    stats[worker_id()].jobs_run++;
+#endif
+  }
+
+#ifdef UTS_STATS
+  // Read by the run statistics once the root computation is done.
+  const worker_stats &worker(int i) { return stats[i]; }
+#endif
+
+  // Workers 0 .. n-1 take part from now on. Worker 0 is the one that
+  // started the run, and is always active.
+  void set_active_workers(int n) {
+    active_limit = std::max(1, std::min(n, num_threads));
+    wake_all();
+  }
+
+  int active_workers() { return active_limit.load(); }
+
+  bool is_active() {
+    return worker_id() < active_limit.load(std::memory_order_relaxed);
+  }
+
+  // Workers asleep across a reset count only their sleep since then.
+  void reset_stats() {
+    reset_ns.store(now_ns());
+    for (auto &s : stats) s = worker_stats();
+  }
+
+  long long total_steals() {
+    long long n = 0;
+    for (auto &s : stats)
+      for (int l = 0; l < STEAL_LEVELS; l++) n += s.steals[l];
+    return n;
+  }
+
+  void print_stats(FILE *f) {
+    bool pinned = (pinning != PIN_NONE);
+    fprintf(f, "Scheduler: %d workers (%d active), pinning = %s on %d cpus, %d socket(s)\n",
+            num_threads, active_workers(), pin_policy_str[pinning],
+            topo.num_cpus(), topo.num_sockets());
+    fprintf(f, "Idle workers: spin %ld us, yield %ld us, then sleep%s\n",
+            spin_ns / 1000, yield_ns / 1000,
+            oversubscribed ? " (oversubscribed, no spinning)" : "");
+    fprintf(f, "Steal policy: victim = %s, amount = %s, prefer = %s\n",
+            steal_victim_str[victim], steal_amount_str[amount],
+            steal_prefer_str[prefer]);
+    if (pinned)
+      fprintf(f, "%6s %5s %12s %12s %12s %14s", "worker", "cpu",
+              "steals(L3)", "(socket)", "(remote)", "failed steals");
+    else
+      fprintf(f, "%6s %5s %12s %14s", "worker", "cpu", "steals",
+              "failed steals");
+    fprintf(f, " %10s %10s", "stolen jobs", "depth");
+    fprintf(f, " %10s %10s %8s %8s %10s %10s\n", "spin(ms)", "sleep(ms)",
+            "sleeps", "wakeups", "wake(us)", "max(us)");
+
+    worker_stats total;
+    for (int i = 0; i < num_threads; i++) {
+      worker_stats &s = stats[i];
+      for (int l = 0; l < STEAL_LEVELS; l++) total.steals[l] += s.steals[l];
+      total.failed_steals += s.failed_steals;
+      total.stolen += s.stolen;
+      total.stolen_depth += s.stolen_depth;
+      total.spin_ns += s.spin_ns;
+      total.sleep_ns += s.sleep_ns;
+      total.sleeps += s.sleeps;
+      total.wakeups += s.wakeups;
+      total.wake_ns += s.wake_ns;
+      total.max_wake_ns = std::max(total.max_wake_ns, s.max_wake_ns);
+      total.replayed += s.replayed;
+      print_row(f, std::to_string(i).c_str(), workers[i].cpu, s, pinned);
+    }
+    print_row(f, "total", -1, total, pinned);
+    if (record != nullptr)
+      fprintf(f, "Recording steals to %s\n", record);
+    if (replay != nullptr) {
+      // a path recorded but never spawned means the spawn tree differs
+      // from the recorded one, and so does the schedule enforced
+      fprintf(f, "Replaying %s: %llu of %zu recorded jobs matched, %lld"
+              " steals enforced\n", replay, total.replayed, replay_to.size(),
+              total_steals());
+      if (total.replayed < replay_to.size())
+        fprintf(f, "*** %zu recorded jobs were never spawned: the spawn tree"
+                " differs from the recorded run\n",
+                (size_t) (replay_to.size() - total.replayed));
+    }
+  }
+
+ private:
+  // Where a worker runs, and whom it steals from: victims are grouped
+  // by level, victims[level_end[l-1] .. level_end[l]) being level l.
+  struct alignas(64) worker_info {
+    int cpu = -1;
+    std::vector<int> victims;
+    int level_end[STEAL_LEVELS] = {};
+    size_t attempts = 0;
+    size_t next_victim = 0;   // round-robin cursor
+    int last_victim = -1;     // index into victims
+  };
+
+  // Jobs handed to a worker by replay.
+  struct alignas(64) mailbox {
+    std::mutex lock;
+    std::deque<Job*> jobs;
+    std::atomic<int> size{0};
+  };
+
+  // A worker sleeps on word. Whoever clears asleep owns the wakeup,
+  // bumps word and wakes it.
+  struct alignas(64) sleeper {
+    std::atomic<uint32_t> word{0};
+    std::atomic<bool> asleep{false};
+    std::atomic<long> woken_at{0};
+  };
+
+  topology topo;
+  std::vector<Deque<Job>> deques;
+  std::vector<worker_info> workers;
+  std::vector<worker_stats> stats;
+  std::vector<sleeper> sleepers;
+  std::vector<std::thread> spawned_threads;
+  std::atomic<int> active_limit;
+  alignas(64) std::atomic<int> num_sleeping;
+  std::atomic<int> finished_flag;
+  int victim, amount, prefer;
+  bool oversubscribed;
+  long spin_ns, yield_ns;
+  const char *record, *replay;
+  std::vector<std::vector<steal_record>> steal_logs;
+  std::vector<mailbox> mailboxes;
+  std::unordered_map<uint64_t, int> replay_to;   // job path -> thief
+  long start_ns;
+  std::atomic<long> reset_ns{0};     // of the last reset_stats
+
+  // The last thief of each job in the replayed log, as a job taken by a
+  // steal-half can be stolen again.
+  bool load_replay() {
+    std::vector<std::vector<steal_record>> logs;
+    if (!steal_log_read(replay, logs)) return false;
+    if ((int) logs.size() != num_threads)
+      fprintf(stderr, "*** %s was recorded with %zu workers, replaying on %d\n",
+              replay, logs.size(), num_threads);
+    std::vector<steal_record> all;
+    for (auto &log : logs) all.insert(all.end(), log.begin(), log.end());
+    std::stable_sort(all.begin(), all.end(),
+        [] (const steal_record &a, const steal_record &b) { return a.ns < b.ns; });
+    for (const steal_record &r : all)
+      if (r.thief < num_threads) replay_to[r.path] = r.thief;
+    return true;
+  }
+
+  void log_steal(int id, int target, Job* job) {
+    steal_logs[id].push_back({ (uint64_t) (now_ns() - start_ns), job->path,
+                               job->depth, (int16_t) id, (int16_t) target });
+  }
+
+  void mail(int target, Job* job) {
+    mailbox &m = mailboxes[target];
+    {
+      std::lock_guard<std::mutex> g(m.lock);
+      m.jobs.push_back(job);
+      m.size.fetch_add(1);
+    }
+    wake(target);
+  }
+
+  // A replayed steal: the oldest job handed to us.
+  Job* take_mail(int id) {
+    mailbox &m = mailboxes[id];
+    if (m.size.load() == 0) return nullptr;
+    Job* job;
+    {
+      std::lock_guard<std::mutex> g(m.lock);
+      job = m.jobs.front();
+      m.jobs.pop_front();
+      m.size.fetch_sub(1);
+    }
+    worker_stats &st = stats[id];
+    st.steals[level_of(id, job->owner)]++;
+    st.stolen++;
+    st.stolen_depth += job->depth;
+    if (record != nullptr) log_steal(id, job->owner, job);
+    UTS_TRACE_EV(trace_steal(id, job->owner, job->depth));
+    return job;
+  }
+
+  void place_workers() {
+    std::vector<int> order = topo.placement(pinning);
+    if (pinning != PIN_NONE)
+      for (int i = 0; i < num_threads; i++)
+        workers[i].cpu = topo.cpus[order[i % order.size()]].cpu;
+    for (int i = 0; i < num_threads; i++) {
+      worker_info &w = workers[i];
+      for (int l = 0; l < STEAL_LEVELS; l++) {
+        for (int j = 0; j < num_threads; j++)
+          if (j != i && level_of(i, j) == l) w.victims.push_back(j);
+        w.level_end[l] = (int) w.victims.size();
+      }
+    }
+  }
+
+  const cpu_info *cpu_of(int worker) {
+    for (const cpu_info &ci : topo.cpus)
+      if (ci.cpu == workers[worker].cpu) return &ci;
+    return nullptr;
+  }
+
+  // Locality of j as seen from i. Unpinned workers may run anywhere,
+  // so they all count as remote.
+  int level_of(int i, int j) {
+    const cpu_info *a = cpu_of(i), *b = cpu_of(j);
+    if (a == nullptr || b == nullptr) return STEAL_REMOTE;
+    if (a->llc == b->llc) return STEAL_LLC;
+    if (a->socket == b->socket) return STEAL_SOCKET;
+    return STEAL_REMOTE;
+  }
+
+  void pin(int i) {
+    if (workers[i].cpu >= 0 && !pin_this_thread(workers[i].cpu) && i == 0)
+      fprintf(stderr, "*** Could not pin workers, running unpinned\n");
+  }
+
+  void print_row(FILE *f, const char *name, int cpu, worker_stats &s,
+                 bool pinned) {
+    char cpubuf[16];
+    snprintf(cpubuf, sizeof(cpubuf), cpu < 0 ? "-" : "%d", cpu);
+    if (pinned)
+      fprintf(f, "%6s %5s %12llu %12llu %12llu %14llu", name, cpubuf,
+              s.steals[STEAL_LLC], s.steals[STEAL_SOCKET],
+              s.steals[STEAL_REMOTE], s.failed_steals);
+    else
+      fprintf(f, "%6s %5s %12llu %14llu", name, cpubuf,
+              s.steals[STEAL_LLC] + s.steals[STEAL_SOCKET] +
+              s.steals[STEAL_REMOTE], s.failed_steals);
+    fprintf(f, " %10llu %10.1f", s.stolen,
+            s.stolen ? (double) s.stolen_depth / s.stolen : 0.0);
+    fprintf(f, " %10.1f %10.1f %8llu %8llu %10.1f %10.1f\n",
+            s.spin_ns / 1e6, s.sleep_ns / 1e6, s.sleeps, s.wakeups,
+            s.wakeups ? s.wake_ns / 1e3 / s.wakeups : 0.0,
+            s.max_wake_ns / 1e3);
+  }
+
+  // Start an individual scheduler task.  Runs until finished().
+  template <typename F>
+  void start(F finished) {
+    while (true) {
+      Job* job = get_job(finished);
+      if (!job) return;
+      run(job);
+    }
+  }
+
+  // One pass over the victims, nearest level first, as many attempts
+  // per level as there are victims in it.
+  Job* try_steal(int id) {
+    worker_info &w = workers[id];
+    int lo = 0;
+    for (int l = 0; l < STEAL_LEVELS; l++) {
+      int hi = w.level_end[l];
+      for (int k = lo; k < hi; k++) {
+        int v = pick_victim(w, id, lo, hi, k == lo);
+        if (prefer == PREFER_HEIGHT) {
+          // the shallowest oldest job among a few victims
+          int best = deques[w.victims[v]].top_depth();
+          for (int p = 1; p < STEAL_PEEK && p < hi - lo; p++) {
+            int c = lo + hash64(((size_t) id << 32) + w.attempts++) % (hi - lo);
+            int d = deques[w.victims[c]].top_depth();
+            if (d < best) { best = d; v = c; }
+          }
+        }
+        Job* job = steal_from(id, w.victims[v]);
+        if (job) {
+          UTS_TRACE_EV(trace_steal(id, w.victims[v], job->depth));
+          stats[id].steals[l]++;
+          w.last_victim = v;
+          return job;
+        }
+        stats[id].failed_steals++;
+      }
+      lo = hi;
+    }
+    return nullptr;
+  }
+
+  // Index into w.victims of the next victim in [lo, hi).
+  int pick_victim(worker_info &w, int id, int lo, int hi, bool first) {
+    if (victim == VICTIM_ROUND_ROBIN)
+      return lo + (int) (w.next_victim++ % (hi - lo));
+    if (victim == VICTIM_LAST && first && w.last_victim >= lo &&
+        w.last_victim < hi)
+      return w.last_victim;
+    // use hashing to get "random" targets
+    return lo + (int) (hash64(((size_t) id << 32) + w.attempts++) % (hi - lo));
+  }
+
+  // Steal the oldest job of target, and with STEAL_HALF up to half of
+  // its deque. The others go to the bottom of our own (empty) deque,
+  // oldest first, where they can be stolen again.
+  Job* steal_from(int id, int target) {
+    Deque<Job> &d = deques[target];
+    auto [job, more] = d.pop_top();
+    if (!job) return nullptr;
+    worker_stats &st = stats[id];
+    st.stolen++;
+    st.stolen_depth += job->depth;
+    if (record != nullptr) log_steal(id, target, job);
+    if (amount == STEAL_HALF && more) {
+      int want = std::min((d.size() + 1) / 2, STEAL_HALF_MAX);
+      for (int i = 0; i < want; i++) {
+        auto [extra, left] = d.pop_top();
+        if (!extra) break;
+        st.stolen++;
+        st.stolen_depth += extra->depth;
+        if (record != nullptr) log_steal(id, target, extra);
+        deques[id].push_bottom(extra);
+        if (!left) break;
+      }
+      if (num_sleeping.load() > 0) wake_one(id);
+    }
+    return job;
+  }
+
+  // Find a job, first trying local stack, then steals. Between steal
+  // passes an idle worker spins with exponential backoff, then yields,
+  // then sleeps until there is work to steal or finished() may hold.
+  template <typename F>
+  Job* get_job(F finished) {
+    int id = worker_id();
+    long idle_since = 0;
+    int backoff = 1;
+    while (true) {
+      if (finished()) break;
+      // An inactive worker leaves even its own jobs to the others.
+      if (!is_active()) {
+        if (!deactivate(id, finished)) break;
+        idle_since = 0;
+        continue;
+      }
+      Job* job = try_pop();
+      if (job) return note_busy(id, idle_since, job);
+      UTS_TRACE_EV(trace_idle_begin(id));
+#ifdef UTS_STATS
+      long t0 = now_ns();
+      if (stats[id].idle_start == 0) stats[id].idle_start = t0;
+#endif
+      job = (replay != nullptr) ? take_mail(id) : try_steal(id);
+#ifdef UTS_STATS
+      long dt = now_ns() - t0;
+      stats[id].steal_ns += dt;
+      if (idle_since != 0) stats[id].idle_steal_ns += dt;
+#endif
+      if (job) return note_busy(id, idle_since, job);
+
+      long now = now_ns();
+      if (idle_since == 0) idle_since = now;
+#ifdef UTS_STATS
+      stats[id].idle_mark = idle_since;
+#endif
+      if (now - idle_since < spin_ns) {
+        for (int i = 0; i < backoff; i++) cpu_relax();
+        backoff = std::min(2 * backoff, 1024);
+      } else if (now - idle_since < spin_ns + yield_ns) {
+        std::this_thread::yield();
+      } else {
+        note_idle(id, idle_since, nullptr);
+        sleep_until(id, [&] () {
+          return finished() || !is_active() || work_available(id);
+        });
+        idle_since = 0;
+        backoff = 1;
+      }
+    }
+    note_busy(id, idle_since, nullptr);
+    return nullptr;
+  }
+
+  Job* note_idle(int id, long idle_since, Job* job) {
+    if (idle_since != 0) stats[id].spin_ns += now_ns() - idle_since;
+#ifdef UTS_STATS
+    stats[id].idle_mark = 0;
+#endif
+    return job;
+  }
+
+  // Leaving get_job, with a job or back to the one it waits in: the
+  // worker is busy again either way.
+  Job* note_busy(int id, long idle_since, Job* job) {
+#ifdef UTS_STATS
+    stats[id].idle_start = 0;
+#endif
+    UTS_TRACE_EV(trace_idle_end(id));
+    return note_idle(id, idle_since, job);
+  }
+
+  bool work_available(int id) {
+    if (replay != nullptr) return mailboxes[id].size.load() > 0;
+    for (int j : workers[id].victims)
+      if (!deques[j].empty()) return true;
+    return false;
+  }
+
+  // Called by a worker above the active limit. It sleeps until it is
+  // reactivated, also inside a wait: the jobs of the frame it waits in
+  // are left to the active workers, and the one finishing the last of
+  // them wakes it. Returns false once finished().
+  template <typename F>
+  bool deactivate(int id, F finished) {
+    sleep_until(id, [&] () { return finished() || is_active(); });
+    return !finished();
+  }
+
+  // Sleep until ready() holds. The sleeper announces itself before
+  // checking ready(), and wakers change what ready() reads before looking
+  // for sleepers, with full fences on both sides, so one of them sees
+  // the other and no wakeup is lost.
+  template <typename R>
+  void sleep_until(int id, R ready) {
+    sleeper &s = sleepers[id];
+    worker_stats &st = stats[id];
+    long start = now_ns();
+    st.sleeps++;
+#ifdef UTS_STATS
+    st.idle_mark = start;
+#endif
+    while (true) {
+      uint32_t word = s.word.load();
+      s.asleep.store(true);
+      num_sleeping.fetch_add(1);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      bool done = ready();
+      if (!done) futex_wait(&s.word, word, SLEEP_TIMEOUT_NS);
+      num_sleeping.fetch_sub(1);
+      if (!s.asleep.exchange(false)) {
+        // somebody woke us up on purpose
+        long latency = now_ns() - s.woken_at.load();
+        st.wakeups++;
+        st.wake_ns += latency;
+        st.max_wake_ns = std::max(st.max_wake_ns, (unsigned long long) latency);
+      }
+      if (done || ready()) break;
+    }
+    st.sleep_ns += now_ns() - std::max(start, reset_ns.load());
+#ifdef UTS_STATS
+    st.idle_mark = 0;
+#endif
+  }
+
+  // Wake worker j if it is asleep. Returns whether it was.
+  bool wake(int j) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    sleeper &s = sleepers[j];
+    if (!s.asleep.load() || !s.asleep.exchange(false)) return false;
+    s.woken_at.store(now_ns());
+    s.word.fetch_add(1);
+    futex_wake(&s.word, 1);
+    return true;
+  }
+
+  // Wake one active sleeper to steal new work, nearest first.
+  void wake_one(int id) {
+    int limit = active_limit.load(std::memory_order_relaxed);
+    for (int j : workers[id].victims)
+      if (j < limit && wake(j)) return;
+  }
+
+  void wake_all() {
+    for (int j = 0; j < num_threads; j++) wake(j);
+  }
+
+  // splitmix64
+  static size_t hash64(size_t x) {
+    x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return x ^ (x >> 31);
+  }
+};
+
+struct fork_join_scheduler {
+  using Job = WorkStealingJob;
+
+  // Underlying scheduler object, started on first use
+  std::unique_ptr<scheduler<Job>> sched;
+  scheduler_options opts;
+
+  fork_join_scheduler() {
+    const char *n = getenv("NUM_THREADS");
+    opts.num_threads = (n != NULL && atoi(n) > 0) ? atoi(n)
+                                                  : topology().num_cpus();
+
+    const char *p = getenv("UTS_PIN");
+    int policy = (p != NULL) ? parse_pin_policy(p) : PIN_NONE;
+    if (policy < 0) {
+      fprintf(stderr, "*** Unknown UTS_PIN policy '%s', running unpinned\n", p);
+      policy = PIN_NONE;
+    }
+    opts.pinning = (pin_policy_t) policy;
+
+    const char *s = getenv("UTS_SPIN_US");
+    if (s != NULL) opts.spin_us = std::max(0, atoi(s));
+    const char *y = getenv("UTS_YIELD_US");
+    if (y != NULL) opts.yield_us = std::max(0, atoi(y));
+
+    opts.victim = env_policy("UTS_VICTIM", steal_victim_str, 3);
+    opts.amount = env_policy("UTS_STEAL", steal_amount_str, 2);
+    opts.prefer = env_policy("UTS_PREFER", steal_prefer_str, 2);
+    opts.record = getenv("UTS_RECORD");
+    opts.replay = getenv("UTS_REPLAY");
+  }
+
+  // a policy named by an environment variable, 0 if unset or unknown
+  static int env_policy(const char *var, const char **names, int n) {
+    const char *v = getenv(var);
+    if (v == NULL) return 0;
+    int i = parse_name(v, names, n);
+    if (i < 0) {
+      fprintf(stderr, "*** Unknown %s '%s', using %s\n", var, v, names[0]);
+      i = 0;
+    }
+    return i;
+  }
+
+  scheduler<Job>& get() {
+    if (!sched) sched = std::make_unique<scheduler<Job>>(opts);
+    return *sched;
+  }
+
+  int num_workers() { return opts.num_threads; }
+  int worker_id() { return scheduler<Job>::thread_id; }
+
+  // restarts the workers on next use
+  void set_num_workers(int n) {
+    sched.reset();
+    opts.num_threads = n;
+  }
+
+  template <typename L, typename R>
+  void pardo(L left, R right, bool conservative = false) {
+    auto right_job = make_job(right);
+    bool pushed = get().spawn(&right_job);
+    if (!sched->is_active()) {
+      // deactivated mid-task: hand both branches to the active workers
+      auto left_job = make_job(left);
+      sched->spawn(&left_job, 0);
+      auto finished = [&]() {
+        return left_job.finished() && right_job.finished();
+      };
+      sched->wait(finished, conservative);
+      return;
+    }
+    int &depth = scheduler<Job>::fork_depth;
+    uint64_t &path = scheduler<Job>::fork_path;
+    uint64_t parent_path = path;
+    depth++;
+    if (sched->tracing) path = steal_path_child(parent_path, 0);
+    left();
+    // (a right branch given away by replay was never pushed)
+    Job* job = pushed ? sched->try_pop() : nullptr;
+    if (job == &right_job) {
+      path = right_job.path;
+      sched->ran_inline();
+      right();
+    } else {
+      // Right was stolen. Anything still in our deque was handed to us
+      // by a steal-half, pushed after right and so above its slot: run
+      // it meanwhile.
+      if (job != nullptr) sched->run(job);
+      auto finished = [&]() { return right_job.finished(); };
+      sched->wait(finished, conservative);
+    }
+    path = parent_path;
+    depth--;
+  }
+
+  template <typename F>
+  size_t get_granularity(size_t start, size_t end, F f) {
+    size_t done = 0;
+    size_t sz = 1;
+    int ticks = 0;
+    do {
+      sz = std::min(sz, end - (start + done));
+      auto tstart = std::chrono::high_resolution_clock::now();
+      for (size_t i = 0; i < sz; i++) f(start + done + i);
+      auto tstop = std::chrono::high_resolution_clock::now();
+      ticks = static_cast<int>((tstop - tstart).count());
+      done += sz;
+      sz *= 2;
+    } while (ticks < 1000 && done < (end - start));
+    return done;
+  }
+
+  template <typename F>
+  void parfor(size_t start, size_t end, F f, size_t granularity = 0,
+              bool conservative = false) {
+    if (end <= start) return;
+    if (granularity == 0) {
+      size_t done = get_granularity(start, end, f);
+      granularity = std::max(done, (end - start) / (128 * num_workers()));
+      parfor_(start + done, end, f, granularity, conservative);
+    } else
+      parfor_(start, end, f, granularity, conservative);
+  }
+
+ private:
+  template <typename F>
+  void parfor_(size_t start, size_t end, F f, size_t granularity,
+               bool conservative) {
+    if ((end - start) <= granularity)
+      for (size_t i = start; i < end; i++) f(i);
+    else {
+      size_t n = end - start;
+      // Not in middle to avoid clashes on set-associative
+      // caches on powers of 2.
+      size_t mid = (start + (9 * (n + 1)) / 16);
+      pardo([&]() { parfor_(start, mid, f, granularity, conservative); },
+            [&]() { parfor_(mid, end, f, granularity, conservative); },
+            conservative);
+    }
+  }
+};
@@ -0,0 +1,389 @@
+/* A work-sharing fork-join scheduler around one global queue, as a
+ * baseline for the work-stealing schedulers, configured from the
+ * environment:
+ *   NUM_THREADS  number of workers (default: the cpus we may run on)
+ *   UTS_BATCH    jobs moved to or from the global queue at once (default 8,
+ *                at most 256)
+ *
+ * par_do(left, right) puts right in the worker's local buffer and runs
+ * left, then takes right back unless another worker took it from the
+ * queue meanwhile; only then does it wait, running other jobs. A worker
+ * shares the oldest batch of its buffer when the buffer reaches two
+ * batches, or when it holds more than one job and some worker is idle.
+ * A worker out of work refills its buffer with a batch from the queue.
+ * Nobody ever looks into another worker's buffer.
+ *
+ * The queue is a bounded lock-free MPMC ring (Vyukov's), extended so that
+ * one CAS claims the slots of a whole batch. Idle workers spin, then
+ * yield, then sleep until a batch is shared.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+#include "topology.h"
+
+// most jobs moved at once
+#define CENTRAL_MAX_BATCH 256
+
+template <typename Job>
+struct mpmc_queue {
+  struct alignas(64) cell {
+    std::atomic<size_t> seq;    // pos: free for pos, pos + 1: holds pos
+    Job *job;
+  };
+
+  size_t mask;
+  std::unique_ptr<cell[]> cells;
+  alignas(64) std::atomic<size_t> enq;
+  alignas(64) std::atomic<size_t> deq;
+
+  // size must be a power of two
+  explicit mpmc_queue(size_t size)
+      : mask(size - 1), cells(new cell[size]), enq(0), deq(0) {
+    for (size_t i = 0; i < size; i++)
+      cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // Enqueue all n jobs, or none if the queue is full. Failed CAS and
+  // stale reads are added to retries.
+  bool push(Job **jobs, int n, long &retries) {
+    size_t pos = enq.load(std::memory_order_relaxed);
+    while (true) {
+      int i = 0;
+      while (i < n && cells[(pos + i) & mask].seq.load(
+                          std::memory_order_acquire) == pos + i)
+        i++;
+      if (i < n) {
+        size_t now = enq.load(std::memory_order_relaxed);
+        if (now == pos) return false;
+        pos = now;
+      } else if (enq.compare_exchange_weak(pos, pos + n,
+                                           std::memory_order_relaxed)) {
+        break;
+      }
+      retries++;
+    }
+    for (int i = 0; i < n; i++) {
+      cell &c = cells[(pos + i) & mask];
+      c.job = jobs[i];
+      c.seq.store(pos + i + 1, std::memory_order_release);
+    }
+    return true;
+  }
+
+  // Dequeue up to n jobs, returns how many.
+  int pop(Job **jobs, int n, long &retries) {
+    size_t pos = deq.load(std::memory_order_relaxed);
+    int k;
+    while (true) {
+      k = 0;
+      while (k < n && cells[(pos + k) & mask].seq.load(
+                          std::memory_order_acquire) == pos + k + 1)
+        k++;
+      if (k == 0) {
+        size_t now = deq.load(std::memory_order_relaxed);
+        if (now == pos) return 0;
+        pos = now;
+      } else if (deq.compare_exchange_weak(pos, pos + k,
+                                           std::memory_order_relaxed)) {
+        break;
+      }
+      retries++;
+    }
+    for (int i = 0; i < k; i++) {
+      cell &c = cells[(pos + i) & mask];
+      jobs[i] = c.job;
+      c.seq.store(pos + i + mask + 1, std::memory_order_release);
+    }
+    return k;
+  }
+};
+
+// A right branch of a par_do, as shared. The owner can take a shared
+// job back, so whoever takes it first claims it, and the record lives
+// until both the owner and the buffer or queue entry let go of it.
+struct central_job {
+  enum { QUEUED = 0, CLAIMED };
+  std::atomic<int> state;
+  std::atomic<int> refs;
+  std::atomic<bool> done;
+  void (*call)(void *);
+  void *arg;
+  central_job *next;            // in a pool
+
+  bool claim() {
+    int queued = QUEUED;
+    return state.load(std::memory_order_relaxed) == QUEUED &&
+           state.compare_exchange_strong(queued, CLAIMED,
+                                         std::memory_order_acq_rel);
+  }
+};
+
+struct alignas(64) central_worker_stats {
+  long flushes = 0, flushed = 0;           // batches and jobs shared
+  long refills = 0, refilled = 0;          // batches and jobs taken
+  long empty = 0;                          // refills finding nothing
+  long full = 0;                           // flushes finding no room
+  long retries = 0;                        // CAS retries on the queue
+  long reclaimed = 0;                      // shared jobs run by their owner
+};
+
+struct central_scheduler {
+  using Job = central_job;
+
+  struct alignas(64) worker {
+    std::deque<Job *> local;
+    Job *pool = nullptr;
+    central_worker_stats stats;
+  };
+
+  static constexpr size_t queue_slots = 1 << 16;
+
+  int num_threads, batch;
+  mpmc_queue<Job> queue;
+  std::vector<worker> workers;
+  std::vector<std::thread> threads;
+  alignas(64) std::atomic<int> idle;       // workers looking for work
+  alignas(64) std::atomic<uint32_t> epoch; // bumped when sharing, for sleepers
+  std::atomic<int> sleepers;
+  std::atomic<bool> shutdown;
+  long stats_since;
+  static inline thread_local int thread_id = 0;
+
+  central_scheduler(int n, int batch)
+      : num_threads(n), batch(batch), queue(queue_slots), workers(n),
+        idle(0), epoch(0), sleepers(0), shutdown(false),
+        stats_since(now_ns()) {
+    for (int i = 1; i < n; i++)
+      threads.emplace_back([this, i] {
+        thread_id = i;
+        auto stop = [this] { return shutdown.load(std::memory_order_acquire); };
+        while (Job *job = get_job(stop, true)) run(job);
+      });
+  }
+
+  ~central_scheduler() {
+    shutdown = true;
+    epoch++;
+    futex_wake(&epoch, INT_MAX);
+    for (auto &t : threads) t.join();
+  }
+
+  int num_workers() { return num_threads; }
+  int worker_id() { return thread_id; }
+
+  template <typename L, typename R>
+  void pardo(L &left, R &right) {
+    Job *job = alloc(workers[thread_id]);
+    job->call = [] (void *r) { (*(R *) r)(); };
+    job->arg = &right;
+    spawn(job);
+    left();
+    worker &w = workers[thread_id];
+    if (!w.local.empty() && w.local.back() == job) {
+      // never shared, nobody else knows of it
+      w.local.pop_back();
+      job->next = w.pool;
+      w.pool = job;
+      right();
+      return;
+    }
+    if (job->claim()) {
+      // shared, but nobody took it yet
+      w.stats.reclaimed++;
+      right();
+    } else {
+      // Running elsewhere: run whatever we get until it is done.
+      auto finished = [&] { return job->done.load(std::memory_order_acquire); };
+      while (Job *j = get_job(finished, false)) run(j);
+    }
+    release(job);
+  }
+
+  void reset_stats() {
+    for (worker &w : workers) w.stats = central_worker_stats();
+    stats_since = now_ns();
+  }
+
+  void print_stats(FILE *f) {
+    double secs = (now_ns() - stats_since) * 1e-9;
+    fprintf(f, "Global queue: batch = %d jobs, %zu slots\n", batch,
+            queue_slots);
+    fprintf(f, "%6s %10s %10s %10s %10s %10s %8s %10s %10s\n", "worker",
+            "flushes", "flushed", "refills", "refilled", "empty", "full",
+            "retries", "reclaimed");
+    central_worker_stats t;
+    for (int i = 0; i < num_threads; i++) {
+      central_worker_stats &s = workers[i].stats;
+      fprintf(f, "%6d %10ld %10ld %10ld %10ld %10ld %8ld %10ld %10ld\n", i,
+              s.flushes, s.flushed, s.refills, s.refilled, s.empty, s.full,
+              s.retries, s.reclaimed);
+      t.flushes += s.flushes;
+      t.flushed += s.flushed;
+      t.refills += s.refills;
+      t.refilled += s.refilled;
+      t.empty += s.empty;
+      t.full += s.full;
+      t.retries += s.retries;
+      t.reclaimed += s.reclaimed;
+    }
+    fprintf(f, "%6s %10ld %10ld %10ld %10ld %10ld %8ld %10ld %10ld\n", "total",
+            t.flushes, t.flushed, t.refills, t.refilled, t.empty, t.full,
+            t.retries, t.reclaimed);
+    long ops = t.flushes + t.full + t.refills + t.empty;
+    fprintf(f, "Queue operations = %ld (%.0f/sec), CAS retries = %.3f per"
+            " operation\n", ops, secs > 0 ? ops / secs : 0.0,
+            ops ? t.retries / (double) ops : 0.0);
+  }
+
+ private:
+  Job *alloc(worker &w) {
+    Job *job = w.pool;
+    if (job != nullptr) w.pool = job->next;
+    else job = new Job;
+    job->state.store(Job::QUEUED, std::memory_order_relaxed);
+    job->refs.store(2, std::memory_order_relaxed);   // owner, and entry
+    job->done.store(false, std::memory_order_relaxed);
+    return job;
+  }
+
+  void release(Job *job) {
+    if (job->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      worker &w = workers[thread_id];
+      job->next = w.pool;
+      w.pool = job;
+    }
+  }
+
+  void run(Job *job) {
+    job->call(job->arg);
+    job->done.store(true, std::memory_order_release);
+    release(job);
+  }
+
+  void spawn(Job *job) {
+    worker &w = workers[thread_id];
+    w.local.push_back(job);
+    size_t n = w.local.size();
+    if (n >= 2 * (size_t) batch ||
+        (n > 1 && idle.load(std::memory_order_relaxed) > 0))
+      flush(w);
+  }
+
+  // Share the oldest jobs of the buffer, keeping the newest one.
+  void flush(worker &w) {
+    int n = (int) std::min((size_t) batch, w.local.size() - 1);
+    Job *jobs[CENTRAL_MAX_BATCH];
+    for (int i = 0; i < n; i++) jobs[i] = w.local[i];
+    if (!queue.push(jobs, n, w.stats.retries)) {
+      w.stats.full++;
+      return;
+    }
+    w.local.erase(w.local.begin(), w.local.begin() + n);
+    w.stats.flushes++;
+    w.stats.flushed += n;
+    if (sleepers.load(std::memory_order_seq_cst) > 0) {
+      epoch.fetch_add(1, std::memory_order_seq_cst);
+      futex_wake(&epoch, n);
+    }
+  }
+
+  bool refill(worker &w) {
+    Job *jobs[CENTRAL_MAX_BATCH];
+    int n = queue.pop(jobs, batch, w.stats.retries);
+    if (n == 0) {
+      w.stats.empty++;
+      return false;
+    }
+    // oldest on top, so that it runs first
+    for (int i = n - 1; i >= 0; i--) w.local.push_back(jobs[i]);
+    w.stats.refills++;
+    w.stats.refilled += n;
+    return true;
+  }
+
+  // The next job to run, claimed, or null once finished(). Only the
+  // workers' own loop may sleep; a par_do waiting for a job running
+  // elsewhere polls until it is done.
+  template <typename F>
+  Job *get_job(F finished, bool may_sleep) {
+    worker &w = workers[thread_id];
+    long tries = 0;
+    Job *job = nullptr;
+    while (!finished()) {
+      if (!w.local.empty()) {
+        Job *j = w.local.back();
+        w.local.pop_back();
+        if (j->claim()) {
+          job = j;
+          break;
+        }
+        release(j);       // taken back by its owner
+        continue;
+      }
+      if (refill(w)) continue;
+      if (tries++ == 0) idle++;
+      if (tries < 64) {
+        cpu_relax();
+      } else if (tries < 1024 || !may_sleep) {
+        std::this_thread::yield();
+      } else {
+        uint32_t e = epoch.load(std::memory_order_seq_cst);
+        sleepers++;
+        if (queue.deq.load() == queue.enq.load() && !finished())
+          futex_wait(&epoch, e, SLEEP_TIMEOUT_NS);
+        sleepers--;
+      }
+    }
+    if (tries > 0) idle--;
+    return job;
+  }
+};
+
+struct central_fork_join {
+  std::unique_ptr<central_scheduler> sched;
+  int num_threads;
+  int batch = 8;
+
+  central_fork_join() {
+    const char *n = getenv("NUM_THREADS");
+    num_threads = (n != NULL && atoi(n) > 0) ? atoi(n) : topology().num_cpus();
+    const char *b = getenv("UTS_BATCH");
+    if (b != NULL && atoi(b) > 0) batch = std::min(atoi(b), CENTRAL_MAX_BATCH);
+  }
+
+  central_scheduler &get() {
+    if (!sched) sched = std::make_unique<central_scheduler>(num_threads, batch);
+    return *sched;
+  }
+
+  int num_workers() { return num_threads; }
+
+  // restarts the workers on next use
+  void set_num_workers(int n) {
+    sched.reset();
+    num_threads = n;
+  }
+
+  template <typename F>
+  void parfor(long start, long end, F &f, long granularity) {
+    if (end - start <= granularity) {
+      for (long i = start; i < end; i++) f(i);
+      return;
+    }
+    long mid = start + (9 * (end - start + 1)) / 16;
+    auto l = [&] { parfor(start, mid, f, granularity); };
+    auto r = [&] { parfor(mid, end, f, granularity); };
+    get().pardo(l, r);
+  }
+};
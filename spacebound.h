@@ -0,0 +1,105 @@
+/* A throttle on the tasks a search exposes, given as a byte budget.
+ *
+ * Every child handed to the scheduler as a task is charged
+ * SPACE_TASK_BYTES, a notional size for its node plus the job record and
+ * deque slot holding it, from the moment it is exposed until it
+ * finishes. Exposing children that would take the outstanding charge
+ * past the budget is refused, and the caller then visits them
+ * depth-first itself. This caps the number of outstanding tasks at
+ * budget / SPACE_TASK_BYTES.
+ *
+ * It is not a bound on the memory of the search, and in particular not
+ * the P x S1 bound of space-efficient schedulers: native stacks are not
+ * charged, tasks a worker steals while it waits at a join run on top of
+ * that join's frames, and the heartbeat policy's joins nest up to
+ * HEARTBEAT_MAX_NEST deep (treesearchpar.h). -v 1 on par reports the
+ * deepest stack of each worker and the peak RSS next to the budget.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+#include "parallel.h"
+#include "uts.h"
+
+// what an exposed task holds: its node, a job record and its deque slot
+#define SPACE_TASK_BYTES (sizeof(Node) + 64)
+
+// Per-worker counters.
+struct alignas(64) space_counts {
+  counter_t granted = 0, refused = 0;   // reservations
+  double throttledTime = 0.0;           // seconds spent on refused work
+};
+
+struct space_budget {
+  long long budget = 0;                 // bytes, 0: unbounded
+  std::atomic<long long> outstanding{0};  // tasks exposed and not finished
+  std::atomic<long long> peak{0};
+  std::vector<space_counts> counts;
+
+  bool enabled() const { return budget > 0; }
+
+  // Bytes with an optional K, M or G suffix, 0 if malformed.
+  static long long parseBytes(const char *s) {
+    char *end;
+    double v = strtod(s, &end);
+    switch (*end) {
+      case 'k': case 'K': v *= 1024.0; end++; break;
+      case 'm': case 'M': v *= 1024.0 * 1024.0; end++; break;
+      case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    }
+    return (*end == '\0' && v > 0) ? (long long) v : 0;
+  }
+
+  void reset(int workers) {
+    outstanding = 0;
+    peak = 0;
+    counts.assign(workers, space_counts());
+  }
+
+  // Expose n more tasks, if the budget allows it. The charge never
+  // exceeds the budget, though concurrent callers may refuse each other.
+  bool reserve(int n) {
+    long long now = outstanding.fetch_add(n) + n;
+    space_counts &c = counts[worker_id()];
+    if (now * (long long) SPACE_TASK_BYTES > budget) {
+      outstanding.fetch_sub(n);
+      c.refused++;
+      return false;
+    }
+    c.granted++;
+    long long p = peak.load(std::memory_order_relaxed);
+    while (now > p && !peak.compare_exchange_weak(p, now)) {}
+    return true;
+  }
+
+  void release(int n) { outstanding.fetch_sub(n); }
+
+  void addThrottled(double seconds) {
+    counts[worker_id()].throttledTime += seconds;
+  }
+
+  void printStats(FILE *f) {
+    space_counts t;
+    for (space_counts &c : counts) {
+      t.granted += c.granted;
+      t.refused += c.refused;
+      t.throttledTime += c.throttledTime;
+    }
+    fprintf(f, "Space budget = %.1f KB, at most %lld outstanding tasks of"
+            " %zu bytes\n", budget / 1024.0,
+            budget / (long long) SPACE_TASK_BYTES, (size_t) SPACE_TASK_BYTES);
+    fprintf(f, "Peak outstanding tasks = %lld, peak bytes = %.1f KB;"
+            " %llu exposures granted, %llu refused\n", peak.load(),
+            peak.load() * (double) SPACE_TASK_BYTES / 1024.0,
+            t.granted, t.refused);
+    fprintf(f, "Time throttled = %.3f sec (summed over workers)\n",
+            t.throttledTime);
+  }
+};
+
+static space_budget spaceBudget;
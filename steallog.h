@@ -0,0 +1,101 @@
+/* Steal logs of the homegrown scheduler, for recording a run's steal
+ * schedule and replaying it (see UTS_RECORD and UTS_REPLAY in
+ * scheduler.h).
+ *
+ * A job is identified by its spawn path: the left (0) and right (1)
+ * branches taken by the par_dos between the root computation and the
+ * job, hashed down to 64 bits. The path does not depend on which worker
+ * runs what, so it names the same job in every run of the same program
+ * on the same input.
+ *
+ * File format, native byte order: a steal_log_header, then for each
+ * worker a uint64_t count and that many steal_records, in the order the
+ * worker stole them.
+ */
+
+#pragma once
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#define STEAL_LOG_MAGIC "UTSSTEAL"
+#define STEAL_LOG_VERSION 1
+
+// the spawn path of the root computation
+#define STEAL_PATH_ROOT 1
+
+struct steal_log_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t workers;
+};
+
+struct steal_record {
+  uint64_t ns;        // since the scheduler started
+  uint64_t path;      // of the stolen job
+  int32_t depth;      // fork depth of the stolen job
+  int16_t thief, victim;
+};
+
+static_assert(sizeof(steal_record) == 24, "steal records are packed");
+
+// path of the left (side 0) or right (side 1) branch of a par_do
+inline uint64_t steal_path_child(uint64_t path, int side) {
+  // splitmix64 of the extended path
+  uint64_t x = path * 2 + side;
+  x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return x ^ (x >> 31);
+}
+
+inline bool steal_log_write(const char *file,
+                            const std::vector<std::vector<steal_record>> &logs) {
+  FILE *f = fopen(file, "wb");
+  if (f == NULL) {
+    fprintf(stderr, "*** Cannot write steal log %s: %s\n", file,
+            strerror(errno));
+    return false;
+  }
+  steal_log_header h;
+  memcpy(h.magic, STEAL_LOG_MAGIC, sizeof(h.magic));
+  h.version = STEAL_LOG_VERSION;
+  h.workers = (uint32_t) logs.size();
+  bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+  for (const std::vector<steal_record> &log : logs) {
+    uint64_t n = log.size();
+    ok = ok && fwrite(&n, sizeof(n), 1, f) == 1;
+    ok = ok && (n == 0 || fwrite(log.data(), sizeof(steal_record), n, f) == n);
+  }
+  ok = (fclose(f) == 0) && ok;
+  if (!ok) fprintf(stderr, "*** Error writing steal log %s\n", file);
+  return ok;
+}
+
+inline bool steal_log_read(const char *file,
+                           std::vector<std::vector<steal_record>> &logs) {
+  FILE *f = fopen(file, "rb");
+  if (f == NULL) {
+    fprintf(stderr, "*** Cannot read steal log %s: %s\n", file,
+            strerror(errno));
+    return false;
+  }
+  steal_log_header h;
+  bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+            memcmp(h.magic, STEAL_LOG_MAGIC, sizeof(h.magic)) == 0 &&
+            h.version == STEAL_LOG_VERSION;
+  if (ok) logs.assign(h.workers, std::vector<steal_record>());
+  for (uint32_t i = 0; ok && i < h.workers; i++) {
+    uint64_t n;
+    ok = fread(&n, sizeof(n), 1, f) == 1;
+    if (ok) {
+      logs[i].resize(n);
+      ok = n == 0 || fread(logs[i].data(), sizeof(steal_record), n, f) == n;
+    }
+  }
+  fclose(f);
+  if (!ok) fprintf(stderr, "*** %s is not a steal log\n", file);
+  return ok;
+}
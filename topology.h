@@ -0,0 +1,186 @@
+/* Machine topology for the homegrown scheduler: which CPUs we may run on,
+ * and how they are grouped into SMT siblings, L3 domains and sockets.
+ * Read from /sys/devices/system/cpu on Linux. Anything that cannot be read
+ * falls back to a flat machine (one socket, one L3 domain, no SMT).
+ */
+
+#pragma once
+
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+struct cpu_info {
+  int cpu;       // OS cpu number
+  int socket;    // physical package id
+  int llc;       // L3 domain, named by the lowest cpu sharing it
+  int core;      // physical core, named by its lowest SMT sibling
+  int smt;       // index of this cpu among its SMT siblings
+};
+
+/* Thread pinning policies
+ *   NONE:    leave placement to the OS.
+ *   COMPACT: fill one L3 domain (SMT siblings included) before the next,
+ *            and one socket before the next.
+ *   SCATTER: round-robin over sockets, compact within each socket.
+ *   CORES:   one worker per physical core first, SMT siblings last.
+ */
+enum pin_policy_e { PIN_NONE = 0, PIN_COMPACT, PIN_SCATTER, PIN_CORES };
+typedef enum pin_policy_e pin_policy_t;
+
+static const char * pin_policy_str[] =
+  { "none", "compact", "scatter", "cores" };
+
+// parse a policy name (or number), -1 if unknown
+inline int parse_pin_policy(const char *s) {
+  for (int i = PIN_NONE; i <= PIN_CORES; i++)
+    if (strcmp(s, pin_policy_str[i]) == 0) return i;
+  if (s[0] >= '0' && s[0] <= '0' + PIN_CORES && s[1] == '\0') return s[0] - '0';
+  return -1;
+}
+
+// parse a Linux cpu list such as "0-3,8,10-11"
+inline std::vector<int> parse_cpu_list(const char *s) {
+  std::vector<int> cpus;
+  while (*s) {
+    char *end;
+    long lo = strtol(s, &end, 10);
+    if (end == s) break;
+    long hi = lo;
+    s = end;
+    if (*s == '-') {
+      hi = strtol(s + 1, &end, 10);
+      s = end;
+    }
+    for (long c = lo; c <= hi; c++) cpus.push_back((int) c);
+    if (*s == ',') s++;
+    else break;
+  }
+  return cpus;
+}
+
+// first line of a sysfs file, empty if it cannot be read
+inline std::string read_sys_line(const std::string &path) {
+  char buf[4096];
+  std::string line;
+  FILE *f = fopen(path.c_str(), "r");
+  if (f == NULL) return line;
+  if (fgets(buf, sizeof(buf), f) != NULL) {
+    line = buf;
+    while (!line.empty() && (line.back() == '\n' || line.back() == ' '))
+      line.pop_back();
+  }
+  fclose(f);
+  return line;
+}
+
+struct topology {
+  std::vector<cpu_info> cpus;   // the cpus in our affinity mask
+
+  topology() {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+      for (int c = 0; c < CPU_SETSIZE; c++)
+        if (CPU_ISSET(c, &mask)) cpus.push_back(describe(c));
+    }
+    if (cpus.empty()) {
+      int n = std::max(1u, std::thread::hardware_concurrency());
+      for (int c = 0; c < n; c++) cpus.push_back(describe(c));
+    }
+
+    // without L3 information, treat each socket as one domain
+    for (cpu_info &ci : cpus) {
+      if (ci.llc >= 0) continue;
+      ci.llc = ci.cpu;
+      for (const cpu_info &o : cpus)
+        if (o.socket == ci.socket) ci.llc = std::min(ci.llc, o.cpu);
+    }
+  }
+
+  int num_cpus() const { return (int) cpus.size(); }
+
+  int num_sockets() const {
+    std::vector<int> s;
+    for (const cpu_info &ci : cpus) s.push_back(ci.socket);
+    std::sort(s.begin(), s.end());
+    return (int) (std::unique(s.begin(), s.end()) - s.begin());
+  }
+
+  // indices into cpus, in the order workers should be placed on them
+  std::vector<int> placement(pin_policy_t policy) const {
+    std::vector<int> order(cpus.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int) i;
+
+    auto compact = [&] (int a, int b) {
+      const cpu_info &x = cpus[a], &y = cpus[b];
+      return std::tie(x.socket, x.llc, x.core, x.smt, x.cpu) <
+             std::tie(y.socket, y.llc, y.core, y.smt, y.cpu);
+    };
+    std::sort(order.begin(), order.end(), compact);
+
+    if (policy == PIN_CORES) {
+      std::stable_sort(order.begin(), order.end(), [&] (int a, int b) {
+        return cpus[a].smt < cpus[b].smt;
+      });
+    } else if (policy == PIN_SCATTER) {
+      // rank of each cpu within its socket, in compact order
+      std::vector<int> rank(cpus.size());
+      for (size_t i = 0; i < order.size(); i++) {
+        int r = 0;
+        for (size_t j = 0; j < i; j++)
+          if (cpus[order[j]].socket == cpus[order[i]].socket) r++;
+        rank[order[i]] = r;
+      }
+      std::stable_sort(order.begin(), order.end(), [&] (int a, int b) {
+        return rank[a] < rank[b];
+      });
+    }
+    return order;
+  }
+
+private:
+  static cpu_info describe(int c) {
+    std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c);
+    cpu_info ci;
+    ci.cpu = c;
+
+    std::string s = read_sys_line(base + "/topology/physical_package_id");
+    ci.socket = s.empty() ? 0 : std::max(0, atoi(s.c_str()));
+
+    std::vector<int> siblings =
+      parse_cpu_list(read_sys_line(base + "/topology/thread_siblings_list").c_str());
+    std::sort(siblings.begin(), siblings.end());
+    ci.core = siblings.empty() ? c : siblings[0];
+    ci.smt = (int) (std::find(siblings.begin(), siblings.end(), c) - siblings.begin());
+    if (ci.smt == (int) siblings.size()) ci.smt = 0;
+
+    ci.llc = -1;
+    for (int i = 0; ; i++) {
+      std::string index = base + "/cache/index" + std::to_string(i);
+      std::string level = read_sys_line(index + "/level");
+      if (level.empty()) break;
+      if (atoi(level.c_str()) != 3) continue;
+      std::vector<int> shared =
+        parse_cpu_list(read_sys_line(index + "/shared_cpu_list").c_str());
+      if (!shared.empty())
+        ci.llc = *std::min_element(shared.begin(), shared.end());
+      break;
+    }
+    return ci;
+  }
+};
+
+// pin the calling thread to one cpu, returns false if not permitted
+inline bool pin_this_thread(int cpu) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  CPU_SET(cpu, &mask);
+  return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+}
@@ -0,0 +1,212 @@
+/* Event tracing, for a timeline of what every worker did, exported as
+ * Chrome trace-event JSON (load it in Perfetto or chrome://tracing).
+ * Built with UTS_TRACE (make par TRACE=1) and enabled by -T file;
+ * otherwise it compiles away.
+ *
+ * Each worker appends to a ring buffer of its own, which no other thread
+ * writes, so recording takes no locks. A full ring overwrites its oldest
+ * events. Timestamps are TSC ticks, converted to microseconds when the
+ * rings are written out after the run. To keep the overhead to a few
+ * percent, events are sampled or filtered by length:
+ *   spawn    one in UTS_TRACE_SAMPLE forks (default 64, rounded up to a
+ *            power of two)
+ *   steal    every steal, with the victim and the depth of the job
+ *   idle     from running out of work until finding some, if it took at
+ *            least UTS_TRACE_MIN_US (default 20)
+ *   subtree  a subtree run as a task, if it took at least
+ *            UTS_TRACE_MIN_US, with its depth and size
+ * UTS_TRACE_EVENTS sets the ring size per worker (default 65536). The
+ * backends in parallel.h record spawns, the homegrown scheduler steals
+ * and idle time, and the tree search subtrees.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef UTS_TRACE
+#define UTS_TRACE_EV(x) x
+#else
+#define UTS_TRACE_EV(x)
+#endif
+
+enum trace_type_e { TRACE_SPAWN = 0, TRACE_STEAL, TRACE_IDLE, TRACE_SUBTREE };
+
+static const char * trace_type_str[] = { "spawn", "steal", "idle", "subtree" };
+
+inline uint64_t trace_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+struct trace_event {
+  uint64_t ts, dur;     // ticks
+  uint64_t arg;         // steal: depth, subtree: nodes
+  uint32_t arg2;        // steal: victim, subtree: depth
+  uint32_t type;
+};
+
+struct alignas(64) trace_ring {
+  std::vector<trace_event> ev;
+  uint64_t n = 0;             // events recorded, including overwritten ones
+  uint64_t forks = 0;         // for sampling spawns
+  uint64_t idle_from = 0;     // out of work since, 0 if busy
+};
+
+struct uts_tracer {
+  bool on = false;
+  const char *file = NULL;
+  std::vector<trace_ring> rings;
+  uint64_t mask = 0;
+  uint64_t sample_mask = 63;
+  uint64_t min_ticks = 0;
+  double ticks_per_us = 1.0;
+  uint64_t tsc0 = 0;
+
+  static long env(const char *var, long dflt) {
+    const char *v = getenv(var);
+    return (v != NULL && atol(v) > 0) ? atol(v) : dflt;
+  }
+
+  static long wall_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+  }
+
+  // Size the rings and calibrate the clock, before the run.
+  void start(int workers) {
+    uint64_t size = 1;
+    while (size < (uint64_t) env("UTS_TRACE_EVENTS", 65536)) size *= 2;
+    mask = size - 1;
+    uint64_t sample = 1;
+    while (sample < (uint64_t) env("UTS_TRACE_SAMPLE", 64)) sample *= 2;
+    sample_mask = sample - 1;
+    rings.assign(workers, trace_ring());
+    for (trace_ring &r : rings) r.ev.resize(size);
+
+    long ns0 = wall_ns();
+    uint64_t t0 = trace_clock();
+    struct timespec pause = { 0, 5000000 };
+    nanosleep(&pause, NULL);
+    ticks_per_us = (trace_clock() - t0) * 1e3 / (double) (wall_ns() - ns0);
+    min_ticks = (uint64_t) (env("UTS_TRACE_MIN_US", 20) * ticks_per_us);
+    tsc0 = trace_clock();
+    on = true;
+  }
+
+  // After the run: idle periods still going on end here.
+  void stop() {
+    on = false;
+    uint64_t now = trace_clock();
+    for (size_t w = 0; w < rings.size(); w++) {
+      trace_ring &r = rings[w];
+      if (r.idle_from != 0 && now - r.idle_from >= min_ticks)
+        record(w, TRACE_IDLE, r.idle_from, now - r.idle_from, 0, 0);
+      r.idle_from = 0;
+    }
+  }
+
+  void record(int w, int type, uint64_t ts, uint64_t dur, uint64_t arg,
+              uint32_t arg2) {
+    if (w < 0 || w >= (int) rings.size()) return;
+    trace_ring &r = rings[w];
+    r.ev[r.n++ & mask] = { ts, dur, arg, arg2, (uint32_t) type };
+  }
+
+  bool write() {
+    FILE *f = fopen(file, "w");
+    if (f == NULL) {
+      fprintf(stderr, "*** Cannot write trace to %s\n", file);
+      return false;
+    }
+    fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1,"
+            " \"args\": {\"name\": \"uts\"}}");
+    uint64_t dropped = 0;
+    for (size_t w = 0; w < rings.size(); w++) {
+      trace_ring &r = rings[w];
+      fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1,"
+              " \"tid\": %zu, \"args\": {\"name\": \"worker %zu\"}}", w, w);
+      uint64_t first = (r.n > mask + 1) ? r.n - (mask + 1) : 0;
+      dropped += first;
+      for (uint64_t i = first; i < r.n; i++) {
+        trace_event &e = r.ev[i & mask];
+        double ts = (int64_t) (e.ts - tsc0) / ticks_per_us;
+        fprintf(f, ",\n{\"name\": \"%s\", \"pid\": 1, \"tid\": %zu,"
+                " \"ts\": %.3f", trace_type_str[e.type], w, ts);
+        switch (e.type) {
+          case TRACE_SPAWN:
+            fprintf(f, ", \"ph\": \"i\", \"s\": \"t\"}");
+            break;
+          case TRACE_STEAL:
+            fprintf(f, ", \"ph\": \"i\", \"s\": \"t\", \"args\": {\"victim\": %u,"
+                    " \"depth\": %llu}}", e.arg2, (unsigned long long) e.arg);
+            break;
+          case TRACE_IDLE:
+            fprintf(f, ", \"ph\": \"X\", \"dur\": %.3f}", e.dur / ticks_per_us);
+            break;
+          case TRACE_SUBTREE:
+            fprintf(f, ", \"ph\": \"X\", \"dur\": %.3f, \"args\": {\"depth\": %u,"
+                    " \"nodes\": %llu}}", e.dur / ticks_per_us, e.arg2,
+                    (unsigned long long) e.arg);
+            break;
+        }
+      }
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    if (dropped > 0)
+      fprintf(stderr, "*** Trace rings overflowed, %llu oldest events lost"
+              " (raise UTS_TRACE_EVENTS)\n", (unsigned long long) dropped);
+    return true;
+  }
+};
+
+inline uts_tracer tracer;
+
+inline void trace_spawn(int w) {
+  if (!tracer.on || w >= (int) tracer.rings.size()) return;
+  if ((++tracer.rings[w].forks & tracer.sample_mask) != 0) return;
+  tracer.record(w, TRACE_SPAWN, trace_clock(), 0, 0, 0);
+}
+
+inline void trace_steal(int w, int victim, int depth) {
+  if (tracer.on) tracer.record(w, TRACE_STEAL, trace_clock(), 0, depth, victim);
+}
+
+inline void trace_idle_begin(int w) {
+  if (!tracer.on || w >= (int) tracer.rings.size()) return;
+  trace_ring &r = tracer.rings[w];
+  if (r.idle_from == 0) r.idle_from = trace_clock();
+}
+
+inline void trace_idle_end(int w) {
+  if (!tracer.on || w >= (int) tracer.rings.size()) return;
+  trace_ring &r = tracer.rings[w];
+  if (r.idle_from == 0) return;
+  uint64_t now = trace_clock();
+  if (now - r.idle_from >= tracer.min_ticks)
+    tracer.record(w, TRACE_IDLE, r.idle_from, now - r.idle_from, 0, 0);
+  r.idle_from = 0;
+}
+
+// from: trace_clock() when the subtree started, 0 if tracing was off
+inline void trace_subtree(int w, uint64_t from, int depth, uint64_t nodes) {
+  if (!tracer.on || from == 0) return;
+  uint64_t now = trace_clock();
+  if (now - from >= tracer.min_ticks)
+    tracer.record(w, TRACE_SUBTREE, from, now - from, nodes, depth);
+}
@@ -0,0 +1,186 @@
+/* Parallel search with coroutine tasks (see coscheduler.h).
+ *
+ * Every node above the depth cutoff runs its children as coroutine tasks
+ * and suspends until they are done; below the cutoff subtrees are
+ * searched by plain recursion inside their task. A suspended node holds
+ * only its coroutine frame, which is recycled through the worker's pool
+ * when the node finishes.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#include "coscheduler.h"
+#include "uts.h"
+
+struct co_config {
+  int workers = 0;            // 0: NUM_THREADS, or all cpus
+  int depthCutoff = 100;      // run sequentially below this depth
+};
+
+static co_config coConfig;
+
+void impl_abort(int err) {
+  exit(err);
+}
+
+const char *impl_getName() {
+  return "mini-uts coroutine tasks";
+}
+
+static int coWorkers() {
+  if (coConfig.workers > 0) return coConfig.workers;
+  if (getenv("NUM_THREADS") != NULL && atoi(getenv("NUM_THREADS")) > 0)
+    return atoi(getenv("NUM_THREADS"));
+  return max(1, (int) std::thread::hardware_concurrency());
+}
+
+int impl_paramsToStr(char *strBuf, int ind) {
+  ind += sprintf(strBuf+ind, "Execution strategy:  %s\n", impl_getName());
+  ind += sprintf(strBuf+ind, "Workers:             %d\n", coWorkers());
+  ind += sprintf(strBuf+ind, "Depth cutoff:        %d\n", coConfig.depthCutoff);
+  return ind;
+}
+
+// Parse the engine's own parameters, return non-success for anything
+// we do not recognize
+int impl_parseParam(char *param, char *value) {
+  switch (param[1]) {
+    case 'p':
+      if (atoi(value) < 1) return 1;
+      coConfig.workers = atoi(value);
+      return 0;
+    case 'C':
+      if (atoi(value) < 0) return 1;
+      coConfig.depthCutoff = atoi(value);
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+void impl_helpMessage() {
+  printf("   -p  int   number of workers\n");
+  printf("   -C  int   run subtrees sequentially below this depth\n");
+}
+
+// ==========================================================================
+
+typedef struct {
+  counter_t maxdepth, size, leaves;
+  counter_t fingerprint;     // with -F, see uts_nodeHash
+} Result;
+
+inline void makeChild(UTSConfig *config, Node *parent, int childType, int i,
+                      Node *child) {
+  child->type = childType;
+  child->height = parent->height + 1;
+  child->numChildren = -1;    // not yet determined
+  for (int j = 0; j < config->computeGranularity; j++) {
+    rng_spawn(parent->state.state, child->state.state, i);
+  }
+}
+
+Result seqSearch(UTSConfig *config, int depth, Node *parent) {
+  int numChildren = uts_numChildren(config, parent);
+  int childType = uts_childType(config, parent);
+  parent->numChildren = numChildren;
+
+  Result r = { (counter_t) depth, 1, 0, 0 };
+  if (config->fingerprint) r.fingerprint = uts_nodeHash(parent);
+  if (numChildren == 0) {
+    r.leaves = 1;
+    return r;
+  }
+  for (int i = 0; i < numChildren; i++) {
+    Node child;
+    makeChild(config, parent, childType, i, &child);
+    Result c = seqSearch(config, depth+1, &child);
+    r.maxdepth = max(r.maxdepth, c.maxdepth);
+    r.size += c.size;
+    r.leaves += c.leaves;
+    r.fingerprint += c.fingerprint;
+  }
+  return r;
+}
+
+task<Result> coSearch(UTSConfig *config, int depth, Node parent) {
+  if (depth > coConfig.depthCutoff)
+    co_return seqSearch(config, depth, &parent);
+
+  int numChildren = uts_numChildren(config, &parent);
+  int childType = uts_childType(config, &parent);
+  parent.numChildren = numChildren;
+
+  Result r = { (counter_t) depth, 1, 0, 0 };
+  if (config->fingerprint) r.fingerprint = uts_nodeHash(&parent);
+  if (numChildren == 0) {
+    r.leaves = 1;
+    co_return r;
+  }
+
+  std::vector<task<Result>> children;
+  children.reserve(numChildren);
+  for (int i = 0; i < numChildren; i++) {
+    Node child;
+    makeChild(config, &parent, childType, i, &child);
+    children.push_back(coSearch(config, depth+1, child));
+  }
+  co_await when_all<Result>(children);
+
+  for (task<Result> &c : children) {
+    r.maxdepth = max(r.maxdepth, c.result().maxdepth);
+    r.size += c.result().size;
+    r.leaves += c.result().leaves;
+    r.fingerprint += c.result().fingerprint;
+  }
+  co_return r;
+}
+
+static std::vector<co_worker_stats> coStats;
+
+Result treeSearch(UTSConfig *config, Node *root) {
+  co_executor ex(coWorkers());
+  task<Result> t = coSearch(config, 0, *root);
+  Result r = ex.run(t);
+  coStats = ex.stats;
+  return r;
+}
+
+// Per-worker steals, and what the tasks cost in frames.
+void co_showStats(UTSConfig *config) {
+  if (config->verbose == 0) return;
+
+  fprintf(stderr, "%6s %12s %12s %10s %10s %10s %10s\n", "worker",
+          "resumed", "spawned", "steals", "failed", "frames", "pool(KB)");
+  co_worker_stats t;
+  for (size_t i = 0; i < coStats.size(); i++) {
+    co_worker_stats &s = coStats[i];
+    fprintf(stderr, "%6zu %12lld %12lld %10lld %10lld %10lld %10.1f\n", i,
+            s.resumed, s.spawned, s.steals, s.failed_steals, s.fresh,
+            s.pool_bytes / 1024.0);
+    t.resumed += s.resumed;
+    t.spawned += s.spawned;
+    t.steals += s.steals;
+    t.failed_steals += s.failed_steals;
+    t.fresh += s.fresh;
+    t.reused += s.reused;
+    t.unpooled += s.unpooled;
+    t.pool_bytes += s.pool_bytes;
+    t.max_frame = max(t.max_frame, s.max_frame);
+  }
+  fprintf(stderr, "%6s %12lld %12lld %10lld %10lld %10lld %10.1f\n", "total",
+          t.resumed, t.spawned, t.steals, t.failed_steals, t.fresh,
+          t.pool_bytes / 1024.0);
+  fprintf(stderr, "Frames: %lld allocated, %lld reused, %lld unpooled,"
+          " largest = %lld bytes\n", t.fresh, t.reused, t.unpooled,
+          t.max_frame);
+  // a pool only grows when all its frames are in use
+  fprintf(stderr, "Peak outstanding tasks <= %lld, frame memory <= %.1f KB"
+          " (%.0f bytes per task)\n\n", t.fresh, t.pool_bytes / 1024.0,
+          t.fresh ? t.pool_bytes / (double) t.fresh : 0.0);
+}
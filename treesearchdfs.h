@@ -0,0 +1,62 @@
+/* The sequential depth-first search, on the native stack. It is the
+ * dfs engine, and the baseline the parallel engine is measured against
+ * (bench -S).
+ */
+
+#pragma once
+
+#include "memstats.h"
+#include "uts.h"
+
+typedef struct {
+  counter_t maxdepth, size, leaves;
+  counter_t fingerprint;     // with -F, see uts_nodeHash
+} Result;
+
+// deepest native stack of the search, one worker
+static stack_usage dfsStack(1);
+
+// Sequential depth-first search of the subtree rooted at parent
+Result dfsSearch(UTSConfig *config, int depth, Node *parent) {
+  int numChildren, childType;
+  counter_t parentHeight = parent->height;
+
+  Result r;
+  r.maxdepth = depth;
+  r.size = 1;
+  r.leaves = 0;
+
+  numChildren = uts_numChildren(config, parent);
+  childType   = uts_childType(config, parent);
+
+  // record number of children in parent
+  parent->numChildren = numChildren;
+  r.fingerprint = config->fingerprint ? uts_nodeHash(parent) : 0;
+
+  // Recurse on the children
+  if (numChildren > 0) {
+    int i, j;
+
+    for (i = 0; i < numChildren; i++) {
+      Node child;
+      child.type = childType;
+      child.height = parentHeight + 1;
+      child.numChildren = -1;    // not yet determined
+      for (j = 0; j < config->computeGranularity; j++) {
+        rng_spawn(parent->state.state, child.state.state, i);
+      }
+      Result c = dfsSearch(config, depth+1, &child);
+
+      if (c.maxdepth > r.maxdepth) r.maxdepth = c.maxdepth;
+      r.size += c.size;
+      r.leaves += c.leaves;
+      r.fingerprint += c.fingerprint;
+    }
+
+  } else {
+    r.leaves = 1;
+    dfsStack.note(0);
+  }
+
+  return r;
+}
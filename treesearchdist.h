@@ -0,0 +1,280 @@
+/* Distributed search by message passing, on one machine.
+ *
+ * Ranks are separate processes connected pairwise by Unix-domain or
+ * loopback TCP sockets, and share nothing else (see dist.h). Each rank
+ * runs a depth-first traversal of its own node stack, and every few
+ * nodes (the polling interval) answers the messages that have arrived:
+ *   STEAL  a rank out of work asks a random victim for some,
+ *   WORK   the reply: the oldest nodes of the victim's stack, up to a
+ *          chunk, shipped as (state, height, type); none if it had none.
+ * Once the token ring finds no work left, rank 0 reduces the results of
+ * all ranks.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <deque>
+#include <vector>
+
+#include "dist.h"
+#include "uts.h"
+
+struct dist_config {
+  int ranks = 4;
+  int chunkSize = 20;         // most nodes shipped per steal
+  int pollInterval = 16;      // nodes visited between polls
+  double latencyUs = 0;       // injected one-way link latency
+  dist_transport_t transport = DIST_UNIX;
+};
+
+static dist_config distConfig;
+
+void impl_abort(int err) {
+  exit(err);
+}
+
+const char *impl_getName() {
+  return "mini-uts distributed work stealing";
+}
+
+int impl_paramsToStr(char *strBuf, int ind) {
+  ind += sprintf(strBuf+ind, "Execution strategy:  %s\n", impl_getName());
+  ind += sprintf(strBuf+ind, "  Ranks:             %d, %s sockets\n",
+                 distConfig.ranks, dist_transport_str[distConfig.transport]);
+  ind += sprintf(strBuf+ind, "  Chunk size:        %d nodes\n",
+                 distConfig.chunkSize);
+  ind += sprintf(strBuf+ind, "  Polling interval:  %d nodes\n",
+                 distConfig.pollInterval);
+  if (distConfig.latencyUs > 0)
+    ind += sprintf(strBuf+ind, "  Link latency:      %.1f us\n",
+                   distConfig.latencyUs);
+  return ind;
+}
+
+// Parse the engine's own parameters, return non-success for anything
+// we do not recognize
+int impl_parseParam(char *param, char *value) {
+  switch (param[1]) {
+    case 'p':
+      if (atoi(value) < 1 || atoi(value) > DIST_MAX_RANKS) return 1;
+      distConfig.ranks = atoi(value);
+      return 0;
+    case 'c':
+      if (atoi(value) < 1) return 1;
+      distConfig.chunkSize = atoi(value);
+      return 0;
+    case 'i':
+      if (atoi(value) < 1) return 1;
+      distConfig.pollInterval = atoi(value);
+      return 0;
+    case 'L':
+      distConfig.latencyUs = max(0.0, atof(value));
+      return 0;
+    case 'k':
+      if (dist_parseTransport(value) < 0) return 1;
+      distConfig.transport = (dist_transport_t) dist_parseTransport(value);
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+void impl_helpMessage() {
+  printf("   -p  int   number of ranks (processes)\n");
+  printf("   -c  int   most nodes shipped per steal\n");
+  printf("   -i  int   polling interval, in nodes visited\n");
+  printf("   -L  dble  injected link latency in microseconds\n");
+  printf("   -k  str   transport: unix or tcp (loopback)\n");
+}
+
+// ==========================================================================
+
+typedef struct {
+  counter_t maxdepth, size, leaves;
+  counter_t fingerprint;     // with -F, see uts_nodeHash
+} Result;
+
+// Per-rank results and counters, sent to rank 0 at the end.
+struct dist_stats {
+  counter_t size, leaves, maxdepth, fingerprint;
+  counter_t steals, failedSteals;         // requests sent, and empty replies
+  counter_t chunksSent, nodesSent;
+  counter_t chunksReceived, nodesReceived;
+  counter_t messages, bytesSent;
+  counter_t stackPeak;                    // most nodes on the stack at once
+  counter_t rssBytes;                     // peak RSS of the rank
+  double workTime, idleTime;
+};
+
+struct dist_rank {
+  UTSConfig *config;
+  dist_link &link;
+  dist_termination term;
+  std::deque<Node> stack;
+  dist_stats st;
+  bool done = false;
+  bool stealing = false;                  // a request is outstanding
+  size_t attempts = 0;
+
+  dist_rank(UTSConfig *config, dist_link &link) : config(config), link(link) {
+    memset(&st, 0, sizeof(st));
+    term.haveToken = (link.id == 0);
+  }
+
+  void service(int timeoutMs) {
+    link.service(timeoutMs, [this] (dist_message &m) { handle(m); });
+  }
+
+  void handle(dist_message &m) {
+    switch (m.h.type) {
+      case MSG_STEAL:
+        if (!done) giveWork(m.from);
+        break;
+      case MSG_WORK: {
+        stealing = false;
+        if (m.h.count == 0) {
+          st.failedSteals++;
+          break;
+        }
+        const dist_node *w = (const dist_node *) m.payload.data();
+        for (int i = 0; i < m.h.count; i++) stack.push_back(dist_unpack(w[i]));
+        term.receivedWork();
+        st.chunksReceived++;
+        st.nodesReceived += m.h.count;
+        break;
+      }
+      case MSG_TOKEN:
+        term.receivedToken(m.h);
+        break;
+      case MSG_DONE:
+        done = true;
+        break;
+    }
+  }
+
+  // Reply to a steal request with the oldest nodes of our stack, up to
+  // a chunk and at most half of them.
+  void giveWork(int to) {
+    int n = min((int) stack.size() / 2, distConfig.chunkSize);
+    std::vector<dist_node> w(n);
+    for (int i = 0; i < n; i++) {
+      w[i] = dist_pack(stack.front());
+      stack.pop_front();
+    }
+    link.send(to, MSG_WORK, n, 0, w.data(), n * sizeof(dist_node));
+    if (n > 0) {
+      term.sentWork();
+      st.chunksSent++;
+      st.nodesSent += n;
+    }
+  }
+
+  void visit() {
+    Node parent = stack.back();
+    stack.pop_back();
+    int numChildren = uts_numChildren(config, &parent);
+    int childType = uts_childType(config, &parent);
+    parent.numChildren = numChildren;
+    st.size++;
+    if (config->fingerprint) st.fingerprint += uts_nodeHash(&parent);
+    if ((counter_t) parent.height > st.maxdepth) st.maxdepth = parent.height;
+
+    if (numChildren == 0) {
+      st.leaves++;
+    } else {
+      for (int i = 0; i < numChildren; i++) {
+        Node child;
+        child.type = childType;
+        child.height = parent.height + 1;
+        child.numChildren = -1;    // not yet determined
+        for (int j = 0; j < config->computeGranularity; j++) {
+          rng_spawn(parent.state.state, child.state.state, i);
+        }
+        stack.push_back(child);
+      }
+      if (stack.size() > st.stackPeak) st.stackPeak = stack.size();
+    }
+  }
+
+  void run() {
+    double t = uts_wctime();
+    while (!done) {
+      if (!stack.empty()) {
+        for (int i = 0; i < distConfig.pollInterval && !stack.empty(); i++)
+          visit();
+        service(0);
+        continue;
+      }
+      double idle = uts_wctime();
+      if (term.haveToken && term.pass(link)) done = true;
+      if (!done && !stealing && link.ranks > 1) {
+        link.send(link.randomPeer(attempts), MSG_STEAL, 0, 0);
+        stealing = true;
+        st.steals++;
+      }
+      if (!done) service(1);
+      st.idleTime += uts_wctime() - idle;
+    }
+    st.workTime = uts_wctime() - t - st.idleTime;
+    st.messages = link.messages;
+    st.bytesSent = link.bytesSent;
+    st.rssBytes = uts_peakRss();
+  }
+};
+
+static std::vector<dist_stats> distResults;
+
+Result treeSearch(UTSConfig *config, Node *root) {
+  dist_launch(distConfig.ranks, distConfig.transport, distConfig.latencyUs,
+              [&] (dist_link &link) {
+    dist_rank r(config, link);
+    if (link.id == 0) r.stack.push_back(*root);
+    r.run();
+    distResults = dist_gather(link, r.st);
+  });
+
+  Result res = {0, 0, 0, 0};
+  uts_memStats = uts_mem_stats();
+  for (dist_stats &s : distResults) {
+    res.size += s.size;
+    res.leaves += s.leaves;
+    res.maxdepth = max(res.maxdepth, s.maxdepth);
+    res.fingerprint += s.fingerprint;
+    uts_memStats.rssBytes += s.rssBytes;
+    uts_memStats.frontierBytes += s.stackPeak * sizeof(Node);
+  }
+  return res;
+}
+
+// Per-rank throughput, steals and traffic.
+void dist_showStats(UTSConfig *config) {
+  if (config->verbose == 0) return;
+
+  fprintf(stderr, "%6s %12s %12s %9s %9s %9s %9s %10s %9s %10s\n", "rank",
+          "nodes", "nodes/sec", "steals", "failed", "chunks in", "nodes in",
+          "chunks out", "messages", "idle(ms)");
+  dist_stats t;
+  memset(&t, 0, sizeof(t));
+  for (size_t i = 0; i < distResults.size(); i++) {
+    dist_stats &s = distResults[i];
+    double busy = s.workTime > 0 ? s.workTime : 1e-9;
+    fprintf(stderr, "%6zu %12llu %12.0f %9llu %9llu %9llu %9llu %10llu %9llu %10.1f\n",
+            i, s.size, s.size / busy, s.steals, s.failedSteals,
+            s.chunksReceived, s.nodesReceived, s.chunksSent, s.messages,
+            s.idleTime * 1e3);
+    t.size += s.size;
+    t.steals += s.steals;
+    t.failedSteals += s.failedSteals;
+    t.chunksReceived += s.chunksReceived;
+    t.nodesReceived += s.nodesReceived;
+    t.chunksSent += s.chunksSent;
+    t.messages += s.messages;
+    t.bytesSent += s.bytesSent;
+  }
+  fprintf(stderr, "%6s %12llu %12s %9llu %9llu %9llu %9llu %10llu %9llu\n",
+          "total", t.size, "", t.steals, t.failedSteals, t.chunksReceived,
+          t.nodesReceived, t.chunksSent, t.messages);
+  fprintf(stderr, "Bytes sent = %llu\n\n", t.bytesSent);
+}
@@ -0,0 +1,415 @@
+/* Hybrid search: threads inside each process, messages between them.
+ *
+ * Ranks are processes connected by sockets as in par_dist (see dist.h).
+ * Inside a rank, the workers search the nodes the rank holds with the
+ * fork-join scheduler, sharing load through par_do. One communication
+ * thread per rank handles the sockets. It answers steal requests from
+ * other ranks by raising exportWanted: the next worker to expand a node
+ * with two or more children, no deeper than exportHeight, hands its last
+ * children, up to a chunk, to the communication thread instead of
+ * spawning them, and those are shipped. Work spawned as tasks cannot be
+ * serialized once it is on a deque, so this is where the surplus is
+ * taken. To export work from near the top of the tree, as a thief taking
+ * the top of a deque would, exportHeight starts at the height of the
+ * last export and goes one level deeper every EXPORT_WAIT_US that a
+ * request waits. A rank without work asks other ranks for some, and
+ * takes part in the token ring.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "parallel.h"
+#include "dist.h"
+#include "uts.h"
+
+// how long a steal request waits before a deeper node may be exported
+#define EXPORT_WAIT_US 10
+
+struct hybrid_config {
+  int ranks = 2;
+  int chunkSize = 20;         // most nodes shipped per steal
+  double latencyUs = 0;       // injected one-way link latency
+  dist_transport_t transport = DIST_UNIX;
+};
+
+static hybrid_config hybridConfig;
+
+void impl_abort(int err) {
+  exit(err);
+}
+
+const char *impl_getName() {
+  return "mini-uts hybrid threads and processes";
+}
+
+int impl_paramsToStr(char *strBuf, int ind) {
+  ind += sprintf(strBuf+ind, "Execution strategy:  %s\n", impl_getName());
+  ind += sprintf(strBuf+ind, "  Ranks:             %d, %s sockets\n",
+                 hybridConfig.ranks,
+                 dist_transport_str[hybridConfig.transport]);
+  ind += sprintf(strBuf+ind, "  Scheduler:         %s\n",
+                 scheduler_name().c_str());
+  ind += sprintf(strBuf+ind, "  Workers per rank:  %d\n", num_workers());
+  ind += sprintf(strBuf+ind, "  Chunk size:        %d nodes\n",
+                 hybridConfig.chunkSize);
+  if (hybridConfig.latencyUs > 0)
+    ind += sprintf(strBuf+ind, "  Link latency:      %.1f us\n",
+                   hybridConfig.latencyUs);
+  return ind;
+}
+
+// Parse the engine's own parameters, return non-success for anything
+// we do not recognize
+int impl_parseParam(char *param, char *value) {
+  switch (param[1]) {
+    case 'P':
+      if (atoi(value) < 1 || atoi(value) > DIST_MAX_RANKS) return 1;
+      hybridConfig.ranks = atoi(value);
+      return 0;
+    case 'p':
+      if (atoi(value) < 1) return 1;
+      set_num_workers(atoi(value));
+      return 0;
+    case 'c':
+      if (atoi(value) < 1) return 1;
+      hybridConfig.chunkSize = atoi(value);
+      return 0;
+    case 'L':
+      hybridConfig.latencyUs = max(0.0, atof(value));
+      return 0;
+    case 'k':
+      if (dist_parseTransport(value) < 0) return 1;
+      hybridConfig.transport = (dist_transport_t) dist_parseTransport(value);
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+void impl_helpMessage() {
+  printf("   -P  int   number of ranks (processes)\n");
+  printf("   -p  int   number of workers per rank\n");
+  printf("   -c  int   most nodes shipped per steal\n");
+  printf("   -L  dble  injected link latency in microseconds\n");
+  printf("   -k  str   transport: unix or tcp (loopback)\n");
+}
+
+// ==========================================================================
+
+typedef struct {
+  counter_t maxdepth, size, leaves;
+  counter_t fingerprint;     // with -F, see uts_nodeHash
+} Result;
+
+// combine the results of two disjoint subtrees
+inline Result combineResults(Result a, Result b) {
+  Result r;
+  r.maxdepth = max(a.maxdepth, b.maxdepth);
+  r.size = a.size + b.size;
+  r.leaves = a.leaves + b.leaves;
+  r.fingerprint = a.fingerprint + b.fingerprint;
+  return r;
+}
+
+const Result emptyResult = {0, 0, 0, 0};
+
+// Per-rank results and counters, sent to rank 0 at the end.
+struct hybrid_stats {
+  counter_t size, leaves, maxdepth, fingerprint;
+  int workers;
+  long long localSteals;                  // -1 if the scheduler has no count
+  counter_t steals, failedSteals;         // remote requests sent, empty replies
+  counter_t chunksSent, nodesSent;
+  counter_t chunksReceived, nodesReceived;
+  counter_t messages, bytesSent, bytesReceived;
+  double idleTime;
+};
+
+struct hybrid_rank {
+  UTSConfig *config;
+  dist_link &link;
+  hybrid_stats st;
+
+  // shared by the workers and the communication thread
+  std::mutex m;
+  std::condition_variable cv;
+  std::vector<Node> bag;                  // nodes waiting to be searched
+  std::deque<std::vector<Node>> donated;  // exported by workers
+  bool searching = false;
+  bool done = false;
+  std::atomic<int> exportWanted{0};
+  std::atomic<int> exportHeight{0};
+
+  // communication thread only
+  dist_termination term;
+  std::deque<int> requesters;             // ranks waiting for a donation
+  double waitingSince = 0;                // of the oldest requester
+  bool stealing = false;                  // a request is outstanding
+  size_t attempts = 0;
+
+  hybrid_rank(UTSConfig *config, dist_link &link) : config(config), link(link) {
+    memset(&st, 0, sizeof(st));
+    term.haveToken = (link.id == 0);
+  }
+
+  // Called by a worker expanding a node: hand the last children to
+  // the communication thread if a request is waiting. Returns the
+  // number of children left to search here.
+  int donate(Node *parent, int numChildren, int childType) {
+    int w = exportWanted.load(std::memory_order_relaxed);
+    if (w <= 0 || parent->height > exportHeight.load(std::memory_order_relaxed) ||
+        !exportWanted.compare_exchange_strong(w, w - 1))
+      return numChildren;
+    exportHeight = parent->height;
+    int n = min(numChildren / 2, hybridConfig.chunkSize);
+    std::vector<Node> nodes(n);
+    for (int i = 0; i < n; i++)
+      nodes[i] = makeChild(parent, numChildren - n + i, childType);
+    std::lock_guard<std::mutex> lock(m);
+    donated.push_back(std::move(nodes));
+    return numChildren - n;
+  }
+
+  Node makeChild(Node *parent, int i, int childType) {
+    Node child;
+    child.type = childType;
+    child.height = parent->height + 1;
+    child.numChildren = -1;    // not yet determined
+    for (int j = 0; j < config->computeGranularity; j++) {
+      rng_spawn(parent->state.state, child.state.state, i);
+    }
+    return child;
+  }
+
+  // no work here, nor on its way here through a worker
+  bool idle() {
+    return !searching && bag.empty() && donated.empty();
+  }
+
+  void communicate() {
+    while (true) {
+      link.service(requesters.empty() ? 1 : 0,
+                   [this] (dist_message &msg) { handle(msg); });
+
+      std::unique_lock<std::mutex> lock(m);
+      if (done) return;
+      while (!donated.empty()) {
+        std::vector<Node> nodes = std::move(donated.front());
+        donated.pop_front();
+        if (requesters.empty()) {
+          // the request was answered meanwhile, search them here
+          bag.insert(bag.end(), nodes.begin(), nodes.end());
+          cv.notify_one();
+          continue;
+        }
+        int to = requesters.front();
+        requesters.pop_front();
+        ship(to, nodes);
+        waitingSince = uts_wctime();
+      }
+      if (!idle()) {
+        if (requesters.empty()) continue;
+        lock.unlock();
+        double now = uts_wctime();
+        if (now - waitingSince > EXPORT_WAIT_US * 1e-6) {
+          exportHeight++;
+          waitingSince = now;
+        }
+        std::this_thread::yield();
+        continue;
+      }
+
+      // idle: turn down requests, pass the token, look for work
+      exportWanted = 0;
+      for (int to : requesters) link.send(to, MSG_WORK, 0, 0);
+      requesters.clear();
+      if (term.haveToken && term.pass(link)) {
+        done = true;
+        cv.notify_one();
+        return;
+      }
+      if (!stealing && link.ranks > 1) {
+        link.send(link.randomPeer(attempts), MSG_STEAL, 0, 0);
+        stealing = true;
+        st.steals++;
+      }
+    }
+  }
+
+  void ship(int to, const std::vector<Node> &nodes) {
+    std::vector<dist_node> w(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) w[i] = dist_pack(nodes[i]);
+    link.send(to, MSG_WORK, (int) w.size(), 0, w.data(),
+              w.size() * sizeof(dist_node));
+    term.sentWork();
+    st.chunksSent++;
+    st.nodesSent += w.size();
+  }
+
+  void handle(dist_message &msg) {
+    switch (msg.h.type) {
+      case MSG_STEAL: {
+        std::lock_guard<std::mutex> lock(m);
+        if (done) break;
+        if (idle()) {
+          link.send(msg.from, MSG_WORK, 0, 0);
+          break;
+        }
+        if (requesters.empty()) waitingSince = uts_wctime();
+        requesters.push_back(msg.from);
+        exportWanted++;
+        break;
+      }
+      case MSG_WORK: {
+        stealing = false;
+        if (msg.h.count == 0) {
+          st.failedSteals++;
+          break;
+        }
+        const dist_node *w = (const dist_node *) msg.payload.data();
+        std::lock_guard<std::mutex> lock(m);
+        for (int i = 0; i < msg.h.count; i++) bag.push_back(dist_unpack(w[i]));
+        cv.notify_one();
+        term.receivedWork();
+        st.chunksReceived++;
+        st.nodesReceived += msg.h.count;
+        break;
+      }
+      case MSG_TOKEN:
+        term.receivedToken(msg.h);
+        break;
+      case MSG_DONE: {
+        std::lock_guard<std::mutex> lock(m);
+        done = true;
+        cv.notify_one();
+        break;
+      }
+    }
+  }
+
+  // The workers' side: search whatever the rank holds, until the run
+  // is over.
+  Result search() {
+    Result total = emptyResult;
+    while (true) {
+      std::vector<Node> work;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        searching = false;
+        double t = uts_wctime();
+        cv.wait(lock, [this] () { return done || !bag.empty(); });
+        st.idleTime += uts_wctime() - t;
+        if (done) break;
+        work.swap(bag);
+        searching = true;
+      }
+      Result r = parallel_reduce(0, (long) work.size(), [&] (long i) {
+        return hybridSearch(&work[i]);
+      }, emptyResult, combineResults, 1);
+      total = combineResults(total, r);
+    }
+    return total;
+  }
+
+  Result hybridSearch(Node *parent) {
+    int numChildren = uts_numChildren(config, parent);
+    int childType = uts_childType(config, parent);
+    parent->numChildren = numChildren;
+    Result r = {(counter_t) parent->height, 1, 0, 0};
+    if (config->fingerprint) r.fingerprint = uts_nodeHash(parent);
+    if (numChildren == 0) {
+      r.leaves = 1;
+      return r;
+    }
+    if (numChildren >= 2) numChildren = donate(parent, numChildren, childType);
+    Result c = parallel_reduce(0, numChildren, [&] (long i) {
+      Node child = makeChild(parent, i, childType);
+      return hybridSearch(&child);
+    }, emptyResult, combineResults, 1);
+    return combineResults(r, c);
+  }
+};
+
+static std::vector<hybrid_stats> hybridResults;
+
+Result treeSearch(UTSConfig *config, Node *root) {
+  dist_launch(hybridConfig.ranks, hybridConfig.transport,
+              hybridConfig.latencyUs, [&] (dist_link &link) {
+    hybrid_rank r(config, link);
+    if (link.id == 0) r.bag.push_back(*root);
+    reset_scheduler_stats();
+
+    std::thread comm([&r] () { r.communicate(); });
+    Result res = r.search();
+    comm.join();
+
+    r.st.size = res.size;
+    r.st.leaves = res.leaves;
+    r.st.maxdepth = res.maxdepth;
+    r.st.fingerprint = res.fingerprint;
+    r.st.workers = num_workers();
+    r.st.localSteals = scheduler_steals();
+    r.st.messages = link.messages;
+    r.st.bytesSent = link.bytesSent;
+    r.st.bytesReceived = link.bytesReceived;
+    hybridResults = dist_gather(link, r.st);
+  });
+
+  Result res = emptyResult;
+  for (hybrid_stats &s : hybridResults) {
+    res.size += s.size;
+    res.leaves += s.leaves;
+    res.maxdepth = max(res.maxdepth, s.maxdepth);
+    res.fingerprint += s.fingerprint;
+  }
+  return res;
+}
+
+// Per-rank throughput, and steals and traffic at both levels.
+void hybrid_showStats(UTSConfig *config, double walltime) {
+  if (config->verbose == 0) return;
+
+  fprintf(stderr, "%6s %8s %12s %12s %12s %9s %9s %9s %9s %10s %12s\n",
+          "rank", "workers", "nodes", "nodes/sec", "local steals",
+          "steals", "failed", "chunks in", "nodes in", "chunks out",
+          "bytes out");
+  hybrid_stats t;
+  memset(&t, 0, sizeof(t));
+  bool counted = true;
+  for (size_t i = 0; i < hybridResults.size(); i++) {
+    hybrid_stats &s = hybridResults[i];
+    char local[24];
+    snprintf(local, sizeof(local), s.localSteals < 0 ? "-" : "%lld",
+             s.localSteals);
+    fprintf(stderr, "%6zu %8d %12llu %12.0f %12s %9llu %9llu %9llu %9llu %10llu %12llu\n",
+            i, s.workers, s.size, s.size / walltime, local, s.steals,
+            s.failedSteals, s.chunksReceived, s.nodesReceived, s.chunksSent,
+            s.bytesSent);
+    counted = counted && s.localSteals >= 0;
+    t.localSteals += s.localSteals;
+    t.steals += s.steals;
+    t.failedSteals += s.failedSteals;
+    t.chunksReceived += s.chunksReceived;
+    t.nodesReceived += s.nodesReceived;
+    t.bytesSent += s.bytesSent;
+    t.messages += s.messages;
+  }
+  if (counted)
+    fprintf(stderr, "Intra-process: %lld steals\n", t.localSteals);
+  else
+    fprintf(stderr, "Intra-process: steals not counted by the %s scheduler\n",
+            scheduler_name().c_str());
+  fprintf(stderr, "Inter-process: %llu steal requests, %llu failed, %llu chunks"
+          " of %llu nodes moved, %llu messages, %llu bytes\n\n", t.steals,
+          t.failedSteals, t.chunksReceived, t.nodesReceived, t.messages,
+          t.bytesSent);
+}
@@ -3,11 +3,49 @@
 #include <string.h>
 #include <math.h>
 #include <iostream>
+#include <vector>
 
 #include "parallel.h"
 #include "utilities.h"
+#include "elastic.h"
+#include "energy.h"
+#include "memstats.h"
+#include "spacebound.h"
+#include "runstats.h"
+#include "perfcounters.h"
+#include "progress.h"
+#include "treesearchdfs.h"
 #include "uts.h"
 
+/* Task creation policies
+ *   DEPTH:     expose parallelism only above a fixed depth cutoff.
+ *   HEARTBEAT: run sequentially, and once every heartbeat period
+ *              promote the oldest unvisited siblings to parallel
+ *              tasks. Parallelism is then created in proportion to
+ *              elapsed work, independent of the tree's depth.
+ *   COST:      expose parallelism only for subtrees whose expected size,
+ *              predicted from the tree parameters, reaches a threshold.
+ */
+enum spawn_policy_e { SPAWN_DEPTH = 0, SPAWN_HEARTBEAT, SPAWN_COST };
+typedef enum spawn_policy_e spawn_policy_t;
+
+const char * spawn_policy_str[] = { "depth cutoff", "heartbeat", "cost model" };
+
+struct par_config {
+  spawn_policy_t policy = SPAWN_DEPTH;
+  int depthCutoff = 100;     // DEPTH: run sequentially below this depth
+  int heartbeatUs = 100;     // HEARTBEAT: promotion period, microseconds
+  double costThreshold = 1000.0; // COST: min expected subtree size to spawn
+  const char *elasticFile = NULL; // elastic mode control file, if any
+};
+
+/* With a space budget (-B), children are only exposed as tasks while the
+ * tasks outstanding fit in it (see spacebound.h). Refused children are
+ * visited inline, as below the cutoff, and their time is throttled.
+ */
+
+static par_config parConfig;
+
 void impl_abort(int err) {
   exit(err);
 }
@@ -19,61 +57,540 @@ const char *impl_getName() {
 int impl_paramsToStr(char *strBuf, int ind) {
   ind += sprintf(strBuf+ind, "Execution strategy:  %s\n", impl_getName());
   ind += sprintf(strBuf+ind, "Scheduler:           %s\n", scheduler_name().c_str());
+  ind += sprintf(strBuf+ind, "Workers:             %d\n", num_workers());
+  if (parConfig.elasticFile != NULL)
+    ind += sprintf(strBuf+ind, "Elastic control:     %s (SIGUSR1/SIGUSR2 to lower/raise)\n",
+                   parConfig.elasticFile);
+  ind += sprintf(strBuf+ind, "Spawn policy:        %d (%s)",
+                 parConfig.policy, spawn_policy_str[parConfig.policy]);
+  if (parConfig.policy == SPAWN_DEPTH)
+    ind += sprintf(strBuf+ind, ", cutoff = %d\n", parConfig.depthCutoff);
+  else if (parConfig.policy == SPAWN_HEARTBEAT)
+    ind += sprintf(strBuf+ind, ", period = %d us\n", parConfig.heartbeatUs);
+  else
+    ind += sprintf(strBuf+ind, ", threshold = %.0f nodes\n",
+                   parConfig.costThreshold);
+  if (spaceBudget.enabled())
+    ind += sprintf(strBuf+ind, "Space budget:        %.1f KB\n",
+                   spaceBudget.budget / 1024.0);
+  if (progressMonitor.interval > 0 || progressMonitor.metricsFile != NULL)
+    ind += sprintf(strBuf+ind, "Progress:            every %.1f s%s%s\n",
+                   progressMonitor.interval > 0 ? progressMonitor.interval
+                                                : PROGRESS_DEFAULT_INTERVAL,
+                   progressMonitor.metricsFile ? ", metrics in " : "",
+                   progressMonitor.metricsFile ? progressMonitor.metricsFile : "");
   return ind;
 }
 
-// Not using UTS command line params, return non-success
+// Parse the parallel engine's own parameters, return non-success
+// for anything we do not recognize
 int impl_parseParam(char *param, char *value) {
-  return 1;
+  switch (param[1]) {
+    case 's':
+      parConfig.policy = (spawn_policy_t) atoi(value);
+      return (parConfig.policy != SPAWN_DEPTH &&
+              parConfig.policy != SPAWN_HEARTBEAT &&
+              parConfig.policy != SPAWN_COST);
+    case 'H':
+      parConfig.heartbeatUs = max(1, atoi(value));
+      return 0;
+    case 'c':
+      parConfig.costThreshold = atof(value);
+      return 0;
+    case 'p':
+      if (atoi(value) < 1) return 1;
+      set_num_workers(atoi(value));
+      return 0;
+    case 'e':
+      parConfig.elasticFile = value;
+      return 0;
+    case 'B':
+      spaceBudget.budget = space_budget::parseBytes(value);
+      return spaceBudget.budget == 0;
+    case 'P':
+      perfCounters.enabled = atoi(value) != 0;
+      return 0;
+    case 'E':
+      raplEnergy.enabled = atoi(value) != 0;
+      return 0;
+    case 'i':
+      progressMonitor.interval = atof(value);
+      return progressMonitor.interval < 0;
+    case 'M':
+      progressMonitor.metricsFile = value;
+      return 0;
+#ifdef UTS_STATS
+    case 'J':
+      runStats.jsonFile = value;
+      return 0;
+#endif
+#ifdef UTS_TRACE
+    case 'T':
+      tracer.file = value;
+      return 0;
+#endif
+    default:
+      return 1;
+  }
 }
 
 void impl_helpMessage() {
-  printf("   none.\n");
+  printf("   -s  int   spawn policy (0: DEPTH cutoff, 1: HEARTBEAT, 2: COST model)\n");
+  printf("   -H  int   HEARTBEAT: promotion period in microseconds\n");
+  printf("   -c  dble  COST: min expected subtree size to run as a task; binomial\n");
+  printf("             levels, estimated alike, use the DEPTH cutoff (%d)\n",
+         parConfig.depthCutoff);
+  printf("   -p  int   number of workers\n");
+  printf("   -e  file  elastic mode: number of active workers is read from file\n");
+  printf("             whenever it changes (\"-\" for none), and SIGUSR1/SIGUSR2\n");
+  printf("             lower/raise it by one\n");
+  printf("   -B  size  cap on outstanding tasks, as bytes at %zu per task (K, M, G\n"
+         "             suffixes); native stacks are not charged\n",
+         (size_t) SPACE_TASK_BYTES);
+  printf("   -P  int   nonzero to report hardware performance counters\n");
+  printf("   -E  int   nonzero to report energy from the RAPL counters\n");
+  printf("   -i  dble  print progress every this many seconds\n");
+  printf("   -M  file  keep progress metrics in file (Prometheus text format)\n");
+#ifdef UTS_STATS
+  printf("   -J  file  write per-worker statistics as JSON (\"-\" for stdout)\n");
+#endif
+#ifdef UTS_TRACE
+  printf("   -T  file  write a timeline of the workers as Chrome trace JSON\n");
+#endif
 }
 
 // ==========================================================================
 
-typedef struct {
-  counter_t maxdepth, size, leaves;
-} Result;
+// Result is that of the sequential search (treesearchdfs.h)
 
-Result treeSearch(UTSConfig *config, int depth, Node *parent) {
+// combine the results of two disjoint subtrees
+inline Result combineResults(Result a, Result b) {
+  Result r;
+  r.maxdepth = max(a.maxdepth, b.maxdepth);
+  r.size = a.size + b.size;
+  r.leaves = a.leaves + b.leaves;
+  r.fingerprint = a.fingerprint + b.fingerprint;
+  return r;
+}
+
+const Result emptyResult = {0, 0, 0, 0};
+
+// Subtrees run as separate tasks versus inline in their parent, per
+// worker. Every node but the root is counted once, in one of the two.
+struct alignas(64) task_counts {
+  counter_t spawned = 0, elided = 0;
+  counter_t framePeak = 0;   // HEARTBEAT: bytes of the largest frame stack
+};
+
+static std::vector<task_counts> taskCounts;
+
+// deepest native stack of each worker, noted at the leaves
+static stack_usage stackUsage;
+
+inline void countTasks(bool spawned, counter_t n) {
+  task_counts &t = taskCounts[worker_id()];
+  if (spawned) t.spawned += n;
+  else t.elided += n;
+}
+
+/* Expected subtree size, by height, predicted from the tree parameters.
+ *   GEO:      S(h) = 1 + b_h * S(h+1), with b_h from the shape function
+ *   BIN:      S = 1 / (1 - qm) below the root (infinite if qm >= 1)
+ *   HYBRID:   GEO above the shift depth, BIN from there on
+ *   BALANCED: S(h) = (b_0^(gen_mx-h+1) - 1) / (b_0 - 1)
+ * The truncation of the geometric distribution at MAXNUMCHILDREN is
+ * ignored. The BIN estimate is the same at every height, so it cannot
+ * tell large subtrees from small ones: spawning on it alone would spawn
+ * at no node or at every node. Heights it covers are left to the depth
+ * cutoff instead (see spawnChildren).
+ */
+struct cost_model {
+  std::vector<double> size;  // S(h) for h < size.size()
+  double tail;               // S(h) beyond the table
+  bool tailKnown;            // false if the tail is the BIN estimate
+
+  void build(UTSConfig *c) {
+    double q = c->nonLeafProb;
+    int    m = c->nonLeafBF;
+    double binSize = (q * m < 1.0) ? 1.0 / (1.0 - q * m) : HUGE_VAL;
+    int geoDepth = 0;      // GEO generation stops here
+
+    switch (c->type) {
+      case BIN:
+        size.assign(1, 1.0 + floor(c->b_0) * binSize);
+        tail = binSize;
+        tailKnown = false;
+        return;
+      case BALANCED:
+        size.assign(c->gen_mx + 1, 1.0);
+        for (int h = c->gen_mx - 1; h >= 0; h--)
+          size[h] = 1.0 + (int) c->b_0 * size[h+1];
+        tail = 0.0;
+        tailKnown = true;
+        return;
+      case HYBRID:
+        geoDepth = (int) ceil(c->shiftDepth * c->gen_mx);
+        tail = binSize;
+        tailKnown = false;
+        break;
+      case GEO:
+      default:
+        // past the last generation with b_h > 0 (EXPDEC never gets there,
+        // but its b_h decays polynomially so a long table converges)
+        geoDepth = (c->shape_fn == CYCLIC) ? 5 * c->gen_mx + 1 :
+                   (c->shape_fn == EXPDEC) ? max(1000, 10 * c->gen_mx) :
+                   c->gen_mx;
+        tail = 1.0;
+        tailKnown = true;
+        break;
+    }
+
+    size.assign(geoDepth + 1, tail);
+    for (int h = geoDepth - 1; h >= 0; h--)
+      size[h] = 1.0 + max(0.0, uts_targetBF_geo(c, h)) * size[h+1];
+  }
+
+  double expectedSize(int height) const {
+    return (height < (int) size.size()) ? size[height] : tail;
+  }
+
+  // Does the model tell subtrees at this height apart?
+  bool informative(int height) const {
+    return height < (int) size.size() || tailKnown;
+  }
+};
+
+static cost_model costModel;
+
+// Should the children of parent be run as separate tasks?
+inline bool spawnChildren(int depth, Node *parent) {
+  int height = parent->height + 1;
+  if (parConfig.policy == SPAWN_COST && costModel.informative(height))
+    return costModel.expectedSize(height) >= parConfig.costThreshold;
+  return depth <= parConfig.depthCutoff;
+}
+
+// throttled: whether the search runs inside children refused by the
+// space budget, whose time an enclosing frame is already taking
+Result cutoffSearch(UTSConfig *config, int depth, Node *parent,
+                    bool throttled = false);
+
+inline void makeChild(UTSConfig *config, Node *parent, int childType,
+                      long i, Node *child) {
+  child->type = childType;
+  child->height = parent->height + 1;
+  child->numChildren = -1;    // not yet determined
+  for (int j = 0; j < config->computeGranularity; j++) {
+    rng_spawn(parent->state.state, child->state.state, i);
+  }
+}
+
+// Children first .. numChildren-1 of parent as separate tasks. Their
+// results are combined up the fork-join tree, so siblings never write to
+// a shared location. Kept out of cutoffSearch, so that the frames of
+// parallel_reduce are only on the stack at the levels that spawn.
+__attribute__((noinline))
+Result spawnSearch(UTSConfig *config, int depth, Node *parent, int first,
+                   int numChildren, int childType, bool bounded,
+                   bool throttled) {
+  UTS_TRACE_EV(uint64_t from = tracer.on ? trace_clock() : 0);
+  Result c = parallel_reduce(first, numChildren, [&] (long i) {
+    Node child;
+    makeChild(config, parent, childType, i, &child);
+    Result s = cutoffSearch(config, depth+1, &child, throttled);
+    if (bounded) spaceBudget.release(1);
+    return s;
+  }, emptyResult, combineResults, 1);
+  // the subtrees traced are those whose children run as tasks (leaves,
+  // the bulk of the nodes, are never timed). With fibers the join may
+  // return on another worker, and only a worker writes to its own ring.
+  UTS_TRACE_EV(trace_subtree(worker_id(), from, depth, c.size + 1));
+  return c;
+}
+
+Result cutoffSearch(UTSConfig *config, int depth, Node *parent,
+                    bool throttled) {
   int numChildren, childType;
-  counter_t parentHeight = parent->height;
 
   Result r;
   r.maxdepth = depth;
   r.size = 1;
   r.leaves = 0;
+  UTS_STAT(runStats.countNode());
+  progressMonitor.countNode();
 
   numChildren = uts_numChildren(config, parent);
   childType   = uts_childType(config, parent);
 
   // record number of children in parent
   parent->numChildren = numChildren;
+  r.fingerprint = config->fingerprint ? uts_nodeHash(parent) : 0;
 
   // Recurse on the children
   if (numChildren == 0) {
     r.leaves = 1;
+    stackUsage.note(worker_id());
     return r;
   }
 
-  long granularity = (depth > 100) ? numChildren : 1;
+  bool spawn = spawnChildren(depth, parent);
+  bool bounded = spawn && spaceBudget.enabled();
+  bool refused = bounded && !spaceBudget.reserve(numChildren);
+  if (refused) spawn = false;
+  countTasks(spawn, numChildren);
 
-  parallel_for(0, numChildren, [&] (long i) {
-    Node child;
-    child.type = childType;
-    child.height = parentHeight + 1;
-    child.numChildren = -1;    // not yet determined
-    for (int j = 0; j < config->computeGranularity; j++) {
-      rng_spawn(parent->state.state, child.state.state, i);
+  Result c = emptyResult;
+  if (spawn) {
+    c = spawnSearch(config, depth, parent, 0, numChildren, childType,
+                    bounded, throttled);
+  } else {
+    // a plain loop: below the cutoff every level is on the native stack,
+    // and T3L has 17844 of them. Refused work nests, as its own children
+    // may be refused too: only the outermost refusal is timed.
+    // A worker deactivated (elastic mode) hands the siblings left to the
+    // scheduler, which passes them on to the active workers: otherwise
+    // it would keep its core until the subtree below the cutoff is done.
+    bool timed = refused && !throttled;
+    double start = timed ? uts_wctime() : 0.0;
+    for (int i = 0; i < numChildren; i++) {
+      if (!worker_active()) {
+        taskCounts[worker_id()].elided -= numChildren - i;
+        countTasks(true, numChildren - i);
+        c = combineResults(c, spawnSearch(config, depth, parent, i,
+                                          numChildren, childType, false,
+                                          throttled || refused));
+        break;
+      }
+      Node child;
+      makeChild(config, parent, childType, i, &child);
+      c = combineResults(c, cutoffSearch(config, depth+1, &child,
+                                         throttled || refused));
     }
-    Result c = treeSearch(config, depth+1, &child);
+    if (timed) spaceBudget.addThrottled(uts_wctime() - start);
+  }
 
-    pbbs::write_max(&r.maxdepth, c.maxdepth, std::less<int>());
-    pbbs::write_add(&r.size, c.size);
-    pbbs::write_add(&r.leaves, c.leaves);
-  }, granularity);
+  r.maxdepth = max(r.maxdepth, c.maxdepth);
+  r.size += c.size;
+  r.leaves = c.leaves;
+  r.fingerprint += c.fingerprint;
+  return r;
+}
 
+// ==========================================================================
+
+// A visited node whose children are not all visited yet
+typedef struct {
+  Node node;
+  int depth;
+  int numChildren, childType;
+  int next;                  // next child to visit
+} Frame;
+
+// check the clock every HEARTBEAT_POLL visited nodes
+#define HEARTBEAT_POLL 16
+
+// Each promotion leaves a join frame (par_do_reduce, parallel_reduce and
+// a heartbeatLoop, about 1.3 KB) on the native stack, and a few jobs on the
+// worker's deque, until the rest of the stack has been traversed. Both
+// the continuation and the promoted subtrees run inside that join, so
+// they inherit its nesting, and no promotion is made beyond
+// HEARTBEAT_MAX_NEST nested joins. Promotions always come from strictly
+// deeper frames, so on deep binomial trees the nesting would otherwise
+// grow with the tree depth.
+#define HEARTBEAT_MAX_NEST 512
+
+inline void makeChild(UTSConfig *config, Frame *f, int i, Node *child) {
+  makeChild(config, &f->node, f->childType, i, child);
+}
+
+// Count node into r, and push it if it has children to visit
+inline void visitNode(UTSConfig *config, int depth, Node *node,
+                      std::vector<Frame> &stack, Result &r) {
+  int numChildren = uts_numChildren(config, node);
+  node->numChildren = numChildren;
+
+  r.size++;
+  r.maxdepth = max(r.maxdepth, (counter_t) depth);
+  if (config->fingerprint) r.fingerprint += uts_nodeHash(node);
+  UTS_STAT(runStats.countNode());
+  progressMonitor.countNode();
+  if (numChildren == 0) {
+    r.leaves++;
+    stackUsage.note(worker_id());
+    return;
+  }
+
+  Frame f;
+  f.node = *node;
+  f.depth = depth;
+  f.numChildren = numChildren;
+  f.childType = uts_childType(config, node);
+  f.next = 0;
+  stack.push_back(f);
+}
+
+Result heartbeatSearch(UTSConfig *config, int depth, Node *root, int nest);
+
+// Depth-first traversal of an explicit stack. When a heartbeat has
+// elapsed, the remaining children of the oldest frame (the ones
+// closest to the root, and so likely the largest) are handed to
+// parallel_reduce while this task carries on with the rest of the stack.
+Result heartbeatLoop(UTSConfig *config, std::vector<Frame> &stack,
+                     double lastBeat, int nest) {
+  Result r = emptyResult;
+  double period = parConfig.heartbeatUs * 1e-6;
+  int polls = 0;
+  bool refused = false;     // the last promotion, by the space budget
+
+  while (!stack.empty()) {
+    Frame *f = &stack.back();
+    if (f->next == f->numChildren) {
+      stack.pop_back();
+      continue;
+    }
+
+    Node child;
+    int depth = f->depth + 1;
+    makeChild(config, f, f->next++, &child);
+    visitNode(config, depth, &child, stack, r);
+    countTasks(false, 1);
+
+    if (++polls < HEARTBEAT_POLL || nest >= HEARTBEAT_MAX_NEST) continue;
+    polls = 0;
+    double now = uts_wctime();
+    // a deactivated worker promotes at once, handing both halves away
+    if (now - lastBeat < period && worker_active()) continue;
+    if (refused) spaceBudget.addThrottled(now - lastBeat);
+    lastBeat = now;
+
+    size_t k = 0;
+    while (k < stack.size() && stack[k].next == stack[k].numChildren) k++;
+    if (k == stack.size()) continue;
+
+    int promotedTasks = stack[k].numChildren - stack[k].next;
+    bool bounded = spaceBudget.enabled();
+    refused = bounded && !spaceBudget.reserve(promotedTasks);
+    if (refused) continue;
+
+    Frame promoted = stack[k];
+    stack[k].next = stack[k].numChildren;
+    countTasks(true, promotedTasks);
+
+    Result rest = par_do_reduce(
+      [&] () {return heartbeatLoop(config, stack, now, nest+1);},
+      [&] () {
+        return parallel_reduce(promoted.next, promoted.numChildren,
+                               [&] (long i) {
+          Node c;
+          makeChild(config, &promoted, i, &c);
+          UTS_TRACE_EV(uint64_t from = tracer.on ? trace_clock() : 0);
+          Result s = heartbeatSearch(config, promoted.depth+1, &c, nest+1);
+          // on the worker the subtree finished on (see spawnSearch)
+          UTS_TRACE_EV(trace_subtree(worker_id(), from, promoted.depth+1,
+                                     s.size));
+          if (bounded) spaceBudget.release(1);
+          return s;
+        }, emptyResult, combineResults, 1);
+      }, combineResults);
+    return combineResults(r, rest);
+  }
+
+  if (refused) spaceBudget.addThrottled(uts_wctime() - lastBeat);
+  return r;
+}
+
+// nest: joins of enclosing promotions the search runs inside
+Result heartbeatSearch(UTSConfig *config, int depth, Node *root, int nest) {
+  std::vector<Frame> stack;
+  Result r = emptyResult;
+  visitNode(config, depth, root, stack, r);
+  r = combineResults(r, heartbeatLoop(config, stack, uts_wctime(), nest));
+  counter_t &peak = taskCounts[worker_id()].framePeak;
+  peak = max(peak, (counter_t) (stack.capacity() * sizeof(Frame)));
+  return r;
+}
+
+// ==========================================================================
+
+// Recorded steals are matched to jobs by spawn path, which names the
+// same job in another run only if the spawn tree does not depend on
+// timing, as it does with heartbeat promotions and a space budget.
+static void checkReplay() {
+#ifdef HOMEGROWN
+  static bool warned = false;
+  const char *var = getenv("UTS_REPLAY") != NULL ? "UTS_REPLAY" :
+                    getenv("UTS_RECORD") != NULL ? "UTS_RECORD" : NULL;
+  if (warned || var == NULL) return;
+  const char *why = (parConfig.policy == SPAWN_HEARTBEAT) ? "-s 1" :
+                    spaceBudget.enabled() ? "-B" : NULL;
+  if (why == NULL) return;
+  warned = true;
+  fprintf(stderr, "*** %s with %s: the spawn tree depends on timing, so a"
+          " replay does not enforce the recorded schedule\n", var, why);
+#endif
+}
+
+Result treeSearch(UTSConfig *config, int depth, Node *parent) {
+  checkReplay();
+  taskCounts.assign(num_workers(), task_counts());
+  spaceBudget.reset(num_workers());
+  stackUsage.reset(num_workers());
+  UTS_STAT(runStats.reset(num_workers()));
+  UTS_TRACE_EV(if (tracer.file != NULL) tracer.start(num_workers()));
+  reset_scheduler_stats();
+  if (parConfig.policy == SPAWN_COST)
+    costModel.build(config);
+
+  Result r;
+  switch (parConfig.policy) {
+    case SPAWN_HEARTBEAT:
+      r = heartbeatSearch(config, depth, parent, 0);
+      break;
+    case SPAWN_DEPTH:
+    default:
+      r = cutoffSearch(config, depth, parent);
+      break;
+  }
+  uts_memStats.stackBytes = stackUsage.deepest();
+  uts_memStats.frontierBytes = 0;
+  for (task_counts &t : taskCounts) uts_memStats.frontierBytes += t.framePeak;
+  UTS_TRACE_EV(tracer.stop());
+#ifdef UTS_STATS
+  runStats.finish();
+  for (size_t i = 0; i < taskCounts.size(); i++)
+    runStats.counts[i].spawned = taskCounts[i].spawned;
+#endif
   return r;
 }
+
+// Report the engine's own statistics, after uts_showStats
+void par_showStats(UTSConfig *config) {
+  counter_t spawned = 0, elided = 0;
+  for (auto &t : taskCounts) {
+    spawned += t.spawned;
+    elided += t.elided;
+  }
+
+  if (config->verbose > 0) {
+    fprintf(stderr, "Tasks spawned = %llu, elided = %llu (%.2f%% inline)\n",
+            spawned, elided,
+            (spawned + elided) ? elided / (double) (spawned + elided) * 100.0 : 0.0);
+    if (parConfig.policy == SPAWN_COST)
+      fprintf(stderr, "Cost model: expected tree size = %.0f nodes\n",
+              costModel.expectedSize(0));
+    if (spaceBudget.enabled())
+      spaceBudget.printStats(stderr);
+    fprintf(stderr, "Deepest native stack per worker (KB):");
+    for (int w = 0; w < (int) stackUsage.marks.size(); w++)
+      fprintf(stderr, " %.1f", stackUsage.used(w) / 1024.0);
+    fprintf(stderr, "\n");
+    if (parConfig.policy == SPAWN_HEARTBEAT) {
+      fprintf(stderr, "Largest frame stack per worker (KB):");
+      for (task_counts &t : taskCounts)
+        fprintf(stderr, " %.1f", t.framePeak / 1024.0);
+      fprintf(stderr, "\n");
+    }
+    print_scheduler_stats(stderr);
+    fprintf(stderr, "\n");
+  }
+}
@@ -0,0 +1,348 @@
+/* Multi-process search: a stand-in for distributed UTS on one node.
+ *
+ * The search forks worker processes that each run a sequential,
+ * explicit node-stack traversal. They share nothing but a shm_open/mmap
+ * segment holding a pool of node chunks: a process with surplus nodes
+ * releases the oldest chunk of its stack to the pool, and a process out
+ * of work acquires one. Both the free and the full chunks are kept in
+ * lock-free stacks with tagged heads.
+ *
+ * Termination: pending counts the busy processes plus the chunks in the
+ * pool. A releaser counts its chunk before publishing it, an acquirer
+ * takes over the chunk's count, and a process running dry drops its own.
+ * Once pending reaches 0 it stays there, and everybody stops.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <deque>
+#include <new>
+#include <vector>
+
+#include "uts.h"
+
+#define SHM_MAX_PROCS 1024
+#define SHM_CHUNKS_PER_PROC 64
+
+struct shm_config {
+  int procs = 4;
+  int chunkSize = 20;
+};
+
+static shm_config shmConfig;
+
+void impl_abort(int err) {
+  exit(err);
+}
+
+const char *impl_getName() {
+  return "mini-uts multi-process shared memory";
+}
+
+int impl_paramsToStr(char *strBuf, int ind) {
+  ind += sprintf(strBuf+ind, "Execution strategy:  %s\n", impl_getName());
+  ind += sprintf(strBuf+ind, "  Processes:         %d\n", shmConfig.procs);
+  ind += sprintf(strBuf+ind, "  Chunk size:        %d nodes\n",
+                 shmConfig.chunkSize);
+  return ind;
+}
+
+// Parse the engine's own parameters, return non-success for anything
+// we do not recognize
+int impl_parseParam(char *param, char *value) {
+  switch (param[1]) {
+    case 'p':
+      if (atoi(value) < 1 || atoi(value) > SHM_MAX_PROCS) return 1;
+      shmConfig.procs = atoi(value);
+      return 0;
+    case 'c':
+      if (atoi(value) < 1) return 1;
+      shmConfig.chunkSize = atoi(value);
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+void impl_helpMessage() {
+  printf("   -p  int   number of processes\n");
+  printf("   -c  int   nodes per chunk moved between processes\n");
+}
+
+// ==========================================================================
+
+typedef struct {
+  counter_t maxdepth, size, leaves;
+  counter_t fingerprint;     // with -F, see uts_nodeHash
+} Result;
+
+// Per-process results and counters, written only by their owner.
+struct alignas(64) shm_proc_stats {
+  counter_t size, leaves, maxdepth, fingerprint;
+  counter_t released, acquired;   // chunks moved through the pool
+  counter_t stackPeak;            // most nodes on the stack at once
+  counter_t rssBytes;             // peak RSS of the process
+  double workTime, idleTime;
+};
+
+struct shm_chunk {
+  uint32_t next;                  // index + 1 of the next chunk, 0 = none
+  int count;
+  Node nodes[];                   // chunkSize of them
+};
+
+// Treiber stack of chunk indices. The head holds a tag in its upper half
+// against ABA, and index + 1 in its lower half.
+struct shm_stack {
+  std::atomic<uint64_t> head;
+};
+
+struct shm_segment {
+  int procs, chunkSize, numChunks;
+  size_t chunkBytes;
+  alignas(64) shm_stack freeChunks;
+  alignas(64) shm_stack fullChunks;
+  alignas(64) std::atomic<long> pending;
+  shm_proc_stats stats[SHM_MAX_PROCS];
+  // chunks follow
+
+  shm_chunk *chunk(uint32_t i) {
+    return (shm_chunk *) ((char *) (this + 1) + i * chunkBytes);
+  }
+
+  void push(shm_stack &s, uint32_t i) {
+    uint64_t old = s.head.load();
+    uint64_t next;
+    do {
+      chunk(i)->next = (uint32_t) old;
+      next = ((old >> 32) + 1) << 32 | (i + 1);
+    } while (!s.head.compare_exchange_weak(old, next));
+  }
+
+  // index of a chunk, -1 if the stack is empty
+  long pop(shm_stack &s) {
+    uint64_t old = s.head.load();
+    uint64_t next;
+    do {
+      uint32_t top = (uint32_t) old;
+      if (top == 0) return -1;
+      next = ((old >> 32) + 1) << 32 | chunk(top - 1)->next;
+    } while (!s.head.compare_exchange_weak(old, next));
+    return (long) (uint32_t) old - 1;
+  }
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "shared memory stacks need lock-free 64-bit atomics");
+
+static shm_segment *shmCreate(int procs, int chunkSize) {
+  int numChunks = procs * SHM_CHUNKS_PER_PROC;
+  size_t chunkBytes = sizeof(shm_chunk) + chunkSize * sizeof(Node);
+  chunkBytes = (chunkBytes + 63) & ~(size_t) 63;
+  size_t bytes = sizeof(shm_segment) + numChunks * chunkBytes;
+
+  char name[64];
+  sprintf(name, "/mini-uts-%d", (int) getpid());
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "*** shm_open %s: %s\n", name, strerror(errno));
+    impl_abort(1);
+  }
+  void *p = MAP_FAILED;
+  if (ftruncate(fd, bytes) == 0)
+    p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  int err = errno;
+  // the mapping is inherited by the workers, the name is not needed
+  shm_unlink(name);
+  close(fd);
+  if (p == MAP_FAILED) {
+    fprintf(stderr, "*** Cannot map %zu bytes of shared memory: %s\n",
+            bytes, strerror(err));
+    impl_abort(1);
+  }
+
+  shm_segment *s = new (p) shm_segment;
+  s->procs = procs;
+  s->chunkSize = chunkSize;
+  s->numChunks = numChunks;
+  s->chunkBytes = chunkBytes;
+  s->freeChunks.head = 0;
+  s->fullChunks.head = 0;
+  s->pending = 1;               // process 0, which holds the root
+  memset(s->stats, 0, sizeof(s->stats));
+  for (int i = numChunks - 1; i >= 0; i--) s->push(s->freeChunks, i);
+  return s;
+}
+
+static size_t shmBytes(shm_segment *s) {
+  return sizeof(shm_segment) + s->numChunks * s->chunkBytes;
+}
+
+// Move the oldest chunk's worth of nodes from the bottom of the stack
+// to the pool. Returns false if no free chunk was left.
+static bool shmRelease(shm_segment *s, std::deque<Node> &stack,
+                       shm_proc_stats &st) {
+  long c = s->pop(s->freeChunks);
+  if (c < 0) return false;
+  shm_chunk *ch = s->chunk(c);
+  ch->count = s->chunkSize;
+  for (int i = 0; i < s->chunkSize; i++) {
+    ch->nodes[i] = stack.front();
+    stack.pop_front();
+  }
+  s->pending++;
+  s->push(s->fullChunks, c);
+  st.released++;
+  return true;
+}
+
+// Take a chunk from the pool, until the search is over. Returns false
+// once there is no work left anywhere.
+static bool shmAcquire(shm_segment *s, std::deque<Node> &stack,
+                       shm_proc_stats &st) {
+  double t = uts_wctime();
+  bool found = false;
+  while (true) {
+    long c = s->pop(s->fullChunks);
+    if (c >= 0) {
+      shm_chunk *ch = s->chunk(c);
+      for (int i = 0; i < ch->count; i++) stack.push_back(ch->nodes[i]);
+      s->push(s->freeChunks, c);
+      st.acquired++;
+      found = true;
+      break;
+    }
+    if (s->pending.load() == 0) break;
+    sched_yield();
+  }
+  st.idleTime += uts_wctime() - t;
+  return found;
+}
+
+// One process: depth-first over its own stack, sharing surplus through
+// the pool.
+static void shmWorker(UTSConfig *config, shm_segment *s, int id, Node *root) {
+  shm_proc_stats &st = s->stats[id];
+  std::deque<Node> stack;
+  double t = uts_wctime();
+  bool busy = (root != NULL);     // counted in pending
+  if (root != NULL) stack.push_back(*root);
+
+  while (true) {
+    if (stack.empty()) {
+      if (busy) s->pending--;
+      busy = shmAcquire(s, stack, st);
+      if (!busy) break;
+    }
+
+    Node parent = stack.back();
+    stack.pop_back();
+    int numChildren = uts_numChildren(config, &parent);
+    int childType = uts_childType(config, &parent);
+    parent.numChildren = numChildren;
+    st.size++;
+    if (config->fingerprint) st.fingerprint += uts_nodeHash(&parent);
+    if ((counter_t) parent.height > st.maxdepth) st.maxdepth = parent.height;
+
+    if (numChildren == 0) {
+      st.leaves++;
+    } else {
+      for (int i = 0; i < numChildren; i++) {
+        Node child;
+        child.type = childType;
+        child.height = parent.height + 1;
+        child.numChildren = -1;    // not yet determined
+        for (int j = 0; j < config->computeGranularity; j++) {
+          rng_spawn(parent.state.state, child.state.state, i);
+        }
+        stack.push_back(child);
+      }
+      if (stack.size() > st.stackPeak) st.stackPeak = stack.size();
+    }
+
+    // keep one chunk beyond the one handed out
+    if ((int) stack.size() >= 2 * s->chunkSize) shmRelease(s, stack, st);
+  }
+  st.workTime = uts_wctime() - t - st.idleTime;
+  st.rssBytes = uts_peakRss();
+}
+
+static shm_segment *shmSegment = NULL;
+
+Result treeSearch(UTSConfig *config, Node *root) {
+  shm_segment *s = shmCreate(shmConfig.procs, shmConfig.chunkSize);
+  shmSegment = s;
+
+  std::vector<pid_t> pids;
+  for (int id = 1; id < s->procs; id++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      fprintf(stderr, "*** fork: %s\n", strerror(errno));
+      impl_abort(1);
+    }
+    if (pid == 0) {
+      shmWorker(config, s, id, NULL);
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+  shmWorker(config, s, 0, root);
+
+  for (pid_t pid : pids) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "*** A worker process failed, results are incomplete\n");
+      impl_abort(1);
+    }
+  }
+
+  Result r = {0, 0, 0, 0};
+  uts_memStats = uts_mem_stats();
+  for (int id = 0; id < s->procs; id++) {
+    shm_proc_stats &st = s->stats[id];
+    r.size += st.size;
+    r.leaves += st.leaves;
+    r.maxdepth = max(r.maxdepth, st.maxdepth);
+    r.fingerprint += st.fingerprint;
+    uts_memStats.rssBytes += st.rssBytes;
+    uts_memStats.frontierBytes += st.stackPeak * sizeof(Node);
+  }
+  return r;
+}
+
+// Per-process throughput and transfers through the pool.
+void shm_showStats(UTSConfig *config) {
+  shm_segment *s = shmSegment;
+  if (config->verbose == 0 || s == NULL) return;
+
+  fprintf(stderr, "Processes: %d, chunk size = %d nodes, pool of %d chunks"
+          " (%zu KB shared)\n", s->procs, s->chunkSize, s->numChunks,
+          shmBytes(s) / 1024);
+  fprintf(stderr, "%6s %12s %12s %10s %10s %10s\n", "proc", "nodes",
+          "nodes/sec", "released", "acquired", "idle(ms)");
+  counter_t nodes = 0, released = 0, acquired = 0;
+  for (int id = 0; id < s->procs; id++) {
+    shm_proc_stats &st = s->stats[id];
+    double busy = st.workTime > 0 ? st.workTime : 1e-9;
+    fprintf(stderr, "%6d %12llu %12.0f %10llu %10llu %10.1f\n", id, st.size,
+            st.size / busy, st.released, st.acquired, st.idleTime * 1e3);
+    nodes += st.size;
+    released += st.released;
+    acquired += st.acquired;
+  }
+  fprintf(stderr, "%6s %12llu %12s %10llu %10llu\n\n", "total", nodes, "",
+          released, acquired);
+}
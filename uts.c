@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #ifdef sgi
 #include <time.h>
 #else
@@ -31,6 +32,8 @@ const char * uts_geoshapes_str[] =
   { "Linear decrease", "Exponential decrease",
     "Cyclic", "Fixed branching factor" };
 
+struct uts_mem_stats uts_memStats = { 0, 0, 0 };
+
 /***********************************************************
  *                                                         *
  *  FUNCTIONS                                              *
@@ -78,6 +81,41 @@ double rng_toProb(int n) {
 }
 
 
+/* Hash of a visited node: its RNG state, height and number of children.
+ * Engines add up the hashes of all nodes (mod 2^64), so that the sum can
+ * be reduced in any order and still identifies the tree.
+ */
+static inline counter_t uts_mix(counter_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+counter_t uts_nodeHash(Node *node) {
+  counter_t w[3] = {0, 0, 0};
+  memcpy(w, &node->state, min(sizeof(w), sizeof(node->state)));
+  counter_t h = uts_mix(w[0] ^ ((counter_t) node->height << 32 |
+                                (unsigned) node->numChildren));
+  h = uts_mix(h ^ w[1]);
+  return uts_mix(h ^ w[2]);
+}
+
+// peak resident set size of this process, in bytes
+counter_t uts_peakRss() {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+  return (counter_t) ru.ru_maxrss * 1024;
+}
+
+void uts_showFingerprint(UTSConfig *c, counter_t fingerprint) {
+  if (c->fingerprint == 0) return;
+  if (c->verbose == 0)
+    printf("fingerprint %016llx\n", fingerprint);
+  else
+    fprintf(stderr, "Tree fingerprint = %016llx\n\n", fingerprint);
+}
+
+
 void uts_initRoot(UTSConfig *c, Node * root) {
   root->type = c->type;
   root->height = 0;
@@ -98,11 +136,9 @@ int uts_numChildren_bin(UTSConfig *c, Node * parent) {
 }
 
 
-int uts_numChildren_geo(UTSConfig *c, Node * parent) {
+// target branching factor b_i of GEO nodes at the given depth
+double uts_targetBF_geo(UTSConfig *c, int depth) {
   double b_i = c->b_0;
-  int depth = parent->height;
-  int numChildren, h;
-  double p, u;
 
   // use shape function to compute target b_i
   if (depth > 0){
@@ -136,6 +172,15 @@ int uts_numChildren_geo(UTSConfig *c, Node * parent) {
     }
   }
 
+  return b_i;
+}
+
+
+int uts_numChildren_geo(UTSConfig *c, Node * parent) {
+  double b_i = uts_targetBF_geo(c, parent->height);
+  int numChildren, h;
+  double p, u;
+
   // given target b_i, find prob p so expected value of
   // geometric distribution is b_i.
   p = 1.0 / (1.0 + b_i);
@@ -328,6 +373,8 @@ void uts_parseParams(UTSConfig *c, int argc, char *argv[]){
         c->shiftDepth = atof(argv[i+1]); break;
       case 'g':
         c->computeGranularity = max(1,atoi(argv[i+1])); break;
+      case 'F':
+        c->fingerprint = atoi(argv[i+1]); break;
       default:
         err = i;
     }
@@ -359,6 +406,7 @@ void uts_helpMessage() {
   printf("   -m  int   BIN: number of children for non-leaf node\n");
   printf("   -f  dble  HYBRID: fraction of depth for GEO -> BIN transition\n");
   printf("   -g  int   compute granularity: number of rng_spawns per node\n");
+  printf("   -F  int   nonzero to compute the tree fingerprint\n");
   printf("   -v  int   nonzero to set verbose output\n");
   printf("   -x  int   debug level\n");
 
@@ -379,8 +427,16 @@ void uts_showStats(UTSConfig *c, int nPes, int chunkSize, double walltime, count
 
   // summarize execution info for human consumption
   else {
+    struct uts_mem_stats *m = &uts_memStats;
+    counter_t rss = m->rssBytes ? m->rssBytes : uts_peakRss();
     fprintf(stderr,"Tree size = %llu, tree depth = %llu, num leaves = %llu (%.2f%%)\n", nNodes, maxDepth, nLeaves, nLeaves/(float)nNodes*100.0);
-    fprintf(stderr,"Wallclock time = %.3f sec, performance = %.0f nodes/sec (%.0f nodes/sec per PE)\n\n",
+    fprintf(stderr,"Wallclock time = %.3f sec, performance = %.0f nodes/sec (%.0f nodes/sec per PE)\n",
         walltime, (nNodes / walltime), (nNodes / walltime / nPes));
+    fprintf(stderr,"Peak RSS = %.1f MB (%.2f bytes/node)", rss / 1048576.0, rss / (double) nNodes);
+    if (m->stackBytes)
+      fprintf(stderr,", deepest stack = %.1f KB", m->stackBytes / 1024.0);
+    if (m->frontierBytes)
+      fprintf(stderr,", frontier peak = %.1f KB", m->frontierBytes / 1024.0);
+    fprintf(stderr,"\n\n");
   }
 }
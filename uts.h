@@ -113,6 +113,10 @@ struct uts_config {
   /* compute granularity - number of rng evaluations per tree node */
   int computeGranularity = 1;
 
+  /* tree fingerprint - the sum of uts_nodeHash over all nodes, which
+   * does not depend on the order the nodes are visited in */
+  int fingerprint = 0;
+
   /* display parameters */
   int debug    = 0;
   int verbose  = 1;
@@ -123,6 +127,17 @@ typedef struct uts_config UTSConfig;
 /* For stats generation: */
 typedef unsigned long long counter_t;
 
+/* Memory high-water marks of the last search, in bytes, filled in by the
+ * engine and shown by uts_showStats. 0 means not measured, and for
+ * rssBytes that the peak RSS of this process is all there is. */
+struct uts_mem_stats {
+  counter_t rssBytes;        // peak RSS, summed over processes
+  counter_t stackBytes;      // deepest native stack of any worker
+  counter_t frontierBytes;   // explicit stacks or frontiers at their peak
+};
+
+extern struct uts_mem_stats uts_memStats;
+
 void   uts_error(char *str);
 void   uts_parseParams(UTSConfig *c, int argc, char **argv);
 int    uts_paramsToStr(UTSConfig *c, char *strBuf, int ind);
@@ -134,11 +149,16 @@ double uts_wctime();
 
 double rng_toProb(int n);
 
+counter_t uts_nodeHash(Node *node);
+counter_t uts_peakRss();
+void   uts_showFingerprint(UTSConfig *c, counter_t fingerprint);
+
 /* Common tree routines */
 void   uts_initRoot(UTSConfig *c, Node * root);
 int    uts_numChildren(UTSConfig *c, Node *parent);
 int    uts_numChildren_bin(UTSConfig *c, Node * parent);
 int    uts_numChildren_geo(UTSConfig *c, Node * parent);
+double uts_targetBF_geo(UTSConfig *c, int depth);
 int    uts_childType(UTSConfig *c, Node *parent);
 
 /* Implementation Specific Functions */
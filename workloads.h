@@ -0,0 +1,115 @@
+/* The reference workloads of sample_trees.sh, compiled in with the tree
+ * statistics they must produce, so that a run can be checked against
+ * them. Workloads are selected by name (T1, T3L, ...) or by suite
+ * (small, large, xl, xxl, wl, all). An expected depth, leaf count or
+ * fingerprint (uts_nodeHash summed over the tree, -F 1) of 0 is unknown
+ * and not checked.
+ */
+
+#pragma once
+
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "uts.h"
+
+struct uts_workload {
+  const char *name;
+  const char *suite;
+  const char *params;       // as in sample_trees.sh
+  counter_t size, depth, leaves;
+  counter_t fingerprint;
+};
+
+static const uts_workload uts_workloads[] = {
+  { "T1",    "small", "-t 1 -a 3 -d 10 -b 4 -r 19",
+    4130071ULL, 10, 3305118ULL, 0xdeba83e8f3c1dc0dULL },
+  { "T5",    "small", "-t 1 -a 0 -d 20 -b 4 -r 34",
+    4147582ULL, 20, 2181318ULL, 0x0c97a0a1cf66785dULL },
+  { "T2",    "small", "-t 1 -a 2 -d 16 -b 6 -r 502",
+    4117769ULL, 81, 2342762ULL, 0x6de475c4ac2b5dc4ULL },
+  { "T3",    "small", "-t 0 -b 2000 -q 0.124875 -m 8 -r 42",
+    4112897ULL, 1572, 3599034ULL, 0xc4ee94c4872dfd13ULL },
+  { "T4",    "small", "-t 2 -a 0 -d 16 -b 6 -r 1 -q 0.234375 -m 4 -r 1",
+    4132453ULL, 134, 3108986ULL, 0x0d54b9d167bd767eULL },
+  { "T1L",   "large", "-t 1 -a 3 -d 13 -b 4 -r 29",
+    102181082ULL, 13, 81746377ULL, 0x06d2651d91360c61ULL },
+  { "T2L",   "large", "-t 1 -a 2 -d 23 -b 7 -r 220",
+    96793510ULL, 67, 53791152ULL, 0x304ad3c8a7bf486eULL },
+  { "T3L",   "large", "-t 0 -b 2000 -q 0.200014 -m 5 -r 7",
+    111345631ULL, 17844, 89076904ULL, 0x2466c9798902146cULL },
+  { "T1XL",  "xl",    "-t 1 -a 3 -d 15 -b 4 -r 29",
+    1635119272ULL, 15, 1308100063ULL, 0xec5544ad46f6f02bULL },
+  { "T1XXL", "xxl",   "-t 1 -a 3 -d 15 -b 4 -r 19",
+    4230646601ULL, 15, 0, 0 },
+  { "T3XXL", "xxl",   "-t 0 -b 2000 -q 0.499995 -m 2 -r 316",
+    2793220501ULL, 0, 0, 0 },
+  { "T2XXL", "xxl",   "-t 0 -b 2000 -q 0.499999995 -m 2 -r 0",
+    10612052303ULL, 216370, 5306027151ULL, 0 },
+  { "T1WL",  "wl",    "-t 1 -a 3 -d 18 -b 4 -r 19",
+    270751679750ULL, 18, 216601257283ULL, 0 },
+  { "T2WL",  "wl",    "-t 0 -b 2000 -q 0.4999999995 -m 2 -r 559",
+    295393891003ULL, 1021239, 147696946501ULL, 0 },
+  { "T3WL",  "wl",    "-t 0 -b 2000 -q 0.4999995 -m 2 -r 559",
+    157063495159ULL, 758577, 78531748579ULL, 0 },
+};
+
+static const int uts_numWorkloads = sizeof(uts_workloads) / sizeof(uts_workloads[0]);
+
+// Workloads named in a comma-separated list of names and suites, in
+// table order within a suite. Returns false on an unknown name.
+inline bool uts_findWorkloads(const char *list,
+                              std::vector<const uts_workload *> &out) {
+  std::string s(list);
+  size_t from = 0;
+  while (from <= s.size()) {
+    size_t to = s.find(',', from);
+    if (to == std::string::npos) to = s.size();
+    std::string name = s.substr(from, to - from);
+    bool found = false;
+    for (int i = 0; i < uts_numWorkloads; i++) {
+      const uts_workload &w = uts_workloads[i];
+      if (name == w.name || name == w.suite || name == "all") {
+        out.push_back(&w);
+        found = true;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "*** Unknown workload or suite '%s'\n", name.c_str());
+      return false;
+    }
+    from = to + 1;
+  }
+  return true;
+}
+
+// Set up config for workload w from the default parameters.
+inline void uts_workloadConfig(const uts_workload &w, UTSConfig *config) {
+  std::vector<std::string> words;
+  const char *p = w.params;
+  while (*p != '\0') {
+    while (*p == ' ') p++;
+    const char *e = p;
+    while (*e != '\0' && *e != ' ') e++;
+    if (e > p) words.push_back(std::string(p, e - p));
+    p = e;
+  }
+  std::vector<char *> argv(1, (char *) w.name);
+  for (std::string &s : words) argv.push_back(&s[0]);
+  *config = UTSConfig();
+  uts_parseParams(config, (int) argv.size(), argv.data());
+}
+
+// Does the result of a run match what w should produce?
+// fingerprinted: whether the run computed its fingerprint (-F 1); any
+// value, 0 included, is then checked
+inline bool uts_checkWorkload(const uts_workload &w, counter_t size,
+                              counter_t depth, counter_t leaves,
+                              bool fingerprinted, counter_t fingerprint) {
+  return size == w.size && (w.depth == 0 || depth == w.depth) &&
+         (w.leaves == 0 || leaves == w.leaves) &&
+         (w.fingerprint == 0 || !fingerprinted ||
+          fingerprint == w.fingerprint);
+}